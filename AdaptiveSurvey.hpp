@@ -0,0 +1,201 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_ADAPTIVE_SURVEY_HPP_INCLUDED_
+#define MANEUVER_TEST_ADAPTIVE_SURVEY_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <vector>
+
+// Local headers.
+#include "Route.hpp"
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Detection scores over the coarse survey grid. Cells whose
+    //! score reaches the threshold are queued once for a fine
+    //! resolution sub-pattern.
+    class HotspotGrid
+    {
+    public:
+      HotspotGrid(void):
+        m_cell(1.0),
+        m_rows(0),
+        m_cols(0),
+        m_threshold(1.0),
+        m_limit(0),
+        m_refined(0)
+      { }
+
+      //! Cover a survey area with cells.
+      //! @param[in] north northing extent from the route origin (m).
+      //! @param[in] east easting extent from the route origin (m).
+      //! @param[in] cell cell size, the coarse row spacing (m).
+      //! @param[in] threshold score at which a cell is refined.
+      //! @param[in] limit maximum number of refined cells.
+      void
+      setup(double north, double east, double cell, double threshold, unsigned limit)
+      {
+        m_cell = cell > 0.0 ? cell : 1.0;
+        m_rows = (unsigned)std::ceil(north / m_cell) + 1;
+        m_cols = (unsigned)std::ceil(east / m_cell) + 1;
+        m_threshold = threshold;
+        m_limit = limit;
+        m_refined = 0;
+        m_score.assign(m_rows * m_cols, 0.0f);
+        m_queued.assign(m_rows * m_cols, false);
+        m_pending.clear();
+      }
+
+      //! Add a detection.
+      //! @param[in] x northing offset (m).
+      //! @param[in] y easting offset (m).
+      //! @param[in] score detection score.
+      //! @return true if the cell was queued for refinement.
+      bool
+      add(double x, double y, double score)
+      {
+        if (score <= 0.0)
+          return false;
+
+        // Cells are centred on the coarse rows.
+        int r = (int)std::floor(x / m_cell + 0.5);
+        int c = (int)std::floor(y / m_cell + 0.5);
+        if (r < 0 || c < 0 || r >= (int)m_rows || c >= (int)m_cols)
+          return false;
+
+        unsigned i = r * m_cols + c;
+        m_score[i] += score;
+
+        if (m_queued[i] || m_score[i] < m_threshold || m_refined >= m_limit)
+          return false;
+
+        m_queued[i] = true;
+        m_pending.push_back(i);
+        ++m_refined;
+        return true;
+      }
+
+      //! Check if cells are waiting for refinement.
+      bool
+      hasPending(void) const
+      {
+        return !m_pending.empty();
+      }
+
+      //! Build sub-patterns over the pending cells, visited nearest
+      //! first from a start position, and clear the pending list.
+      //! @param[in] x start northing offset (m).
+      //! @param[in] y start easting offset (m).
+      //! @param[in] spacing fine row spacing (m).
+      //! @param[in] z vertical reference (m).
+      //! @param[out] wps waypoints to insert.
+      void
+      takePatterns(double x, double y, double spacing, double z, std::vector<Waypoint>& wps)
+      {
+        wps.clear();
+
+        while (!m_pending.empty())
+        {
+          size_t best = 0;
+          double best_d = -1.0;
+          for (size_t k = 0; k < m_pending.size(); ++k)
+          {
+            double dx = (m_pending[k] / m_cols) * m_cell - x;
+            double dy = (m_pending[k] % m_cols) * m_cell - y;
+            double d = dx * dx + dy * dy;
+            if (best_d < 0.0 || d < best_d)
+            {
+              best = k;
+              best_d = d;
+            }
+          }
+
+          unsigned i = m_pending[best];
+          m_pending[best] = m_pending.back();
+          m_pending.pop_back();
+
+          pattern(i, spacing, z, wps);
+          x = wps.back().x;
+          y = wps.back().y;
+        }
+      }
+
+      //! Number of refined cells.
+      unsigned
+      getRefined(void) const
+      {
+        return m_refined;
+      }
+
+    private:
+      //! Cell size (m).
+      double m_cell;
+      //! Cells along north.
+      unsigned m_rows;
+      //! Cells along east.
+      unsigned m_cols;
+      //! Refinement score.
+      double m_threshold;
+      //! Maximum refined cells.
+      unsigned m_limit;
+      //! Cells refined so far.
+      unsigned m_refined;
+      //! Accumulated scores, row major.
+      std::vector<float> m_score;
+      //! True for cells already queued.
+      std::vector<bool> m_queued;
+      //! Cells waiting for a sub-pattern.
+      std::vector<unsigned> m_pending;
+
+      //! Append a fine lawnmower covering a cell.
+      void
+      pattern(unsigned i, double spacing, double z, std::vector<Waypoint>& wps) const
+      {
+        double x0 = (i / m_cols) * m_cell - 0.5 * m_cell;
+        double y0 = (i % m_cols) * m_cell - 0.5 * m_cell;
+        double y1 = y0 + m_cell;
+        unsigned lines = (unsigned)std::floor(m_cell / spacing) + 1;
+
+        for (unsigned k = 0; k < lines; ++k)
+        {
+          double xk = x0 + k * spacing;
+          bool east = k % 2 == 0;
+          wps.push_back(Waypoint(xk, east ? y0 : y1, z, false));
+          wps.push_back(Waypoint(xk, east ? y1 : y0, z, true));
+        }
+      }
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,383 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_COLLISION_AVOIDANCE_HPP_INCLUDED_
+#define MANEUVER_TEST_COLLISION_AVOIDANCE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <vector>
+
+// ISO C++ 11 headers.
+#include <unordered_map>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Number of candidate headings evaluated on each side.
+    static const int c_avoid_headings = 18;
+
+    //! Moving contact in the local frame.
+    struct Contact
+    {
+      //! Contact identifier.
+      uint32_t id;
+      //! Time of last fix (s).
+      double time;
+      //! North position at last fix (m).
+      double x;
+      //! East position at last fix (m).
+      double y;
+      //! North velocity (m/s).
+      double vx;
+      //! East velocity (m/s).
+      double vy;
+      //! Spatial hash cell.
+      long long cell;
+    };
+
+    //! Keeps the latest state of every contact and indexes them in a
+    //! spatial hash, so that the contacts near the vehicle are found
+    //! without scanning the whole list.
+    class ContactTracker
+    {
+    public:
+      //! Constructor.
+      //! @param[in] cell spatial hash cell size (m).
+      //! @param[in] buckets number of hash buckets, a power of two.
+      ContactTracker(double cell = 100.0, unsigned buckets = 1024):
+        m_cell(cell),
+        m_buckets(buckets)
+      { }
+
+      //! Update a contact with a new fix. Velocity comes from the
+      //! given speed and heading or, if speed is negative, from the
+      //! displacement since the previous fix.
+      //! @param[in] id contact identifier.
+      //! @param[in] time fix time (s).
+      //! @param[in] x north position (m).
+      //! @param[in] y east position (m).
+      //! @param[in] heading course over ground (rad).
+      //! @param[in] speed speed over ground (m/s), negative if unknown.
+      void
+      update(uint32_t id, double time, double x, double y, double heading, double speed)
+      {
+        std::unordered_map<uint32_t, size_t>::iterator itr = m_index.find(id);
+
+        if (itr == m_index.end())
+        {
+          Contact c;
+          c.id = id;
+          c.time = time;
+          c.x = x;
+          c.y = y;
+          c.vx = speed > 0.0 ? speed * std::cos(heading) : 0.0;
+          c.vy = speed > 0.0 ? speed * std::sin(heading) : 0.0;
+          c.cell = cellKey(x, y);
+          m_index[id] = m_contacts.size();
+          m_contacts.push_back(c);
+          bucket(c.cell).push_back(id);
+          return;
+        }
+
+        Contact& c = m_contacts[itr->second];
+        double dt = time - c.time;
+
+        if (speed >= 0.0)
+        {
+          c.vx = speed * std::cos(heading);
+          c.vy = speed * std::sin(heading);
+        }
+        else if (dt > 0.1)
+        {
+          // Smooth differenced velocity, fixes are noisy.
+          c.vx = 0.5 * c.vx + 0.5 * (x - c.x) / dt;
+          c.vy = 0.5 * c.vy + 0.5 * (y - c.y) / dt;
+        }
+
+        c.time = time;
+        c.x = x;
+        c.y = y;
+
+        long long cell = cellKey(x, y);
+        if (cell != c.cell)
+        {
+          unlink(c.cell, id);
+          c.cell = cell;
+          bucket(cell).push_back(id);
+        }
+      }
+
+      //! Forget contacts without a fix for a while.
+      //! @param[in] now current time (s).
+      //! @param[in] timeout maximum fix age (s).
+      void
+      expire(double now, double timeout)
+      {
+        for (size_t i = 0; i < m_contacts.size(); )
+        {
+          if (now - m_contacts[i].time <= timeout)
+          {
+            ++i;
+            continue;
+          }
+
+          unlink(m_contacts[i].cell, m_contacts[i].id);
+          m_index.erase(m_contacts[i].id);
+
+          if (i != m_contacts.size() - 1)
+          {
+            m_contacts[i] = m_contacts.back();
+            m_index[m_contacts[i].id] = i;
+          }
+
+          m_contacts.pop_back();
+        }
+      }
+
+      //! Find contacts whose last fix is near a position.
+      //! @param[in] x north position (m).
+      //! @param[in] y east position (m).
+      //! @param[in] radius search radius (m).
+      //! @param[out] out contacts found.
+      void
+      query(double x, double y, double radius, std::vector<const Contact*>& out) const
+      {
+        out.clear();
+
+        long long i0 = (long long)std::floor((x - radius) / m_cell);
+        long long i1 = (long long)std::floor((x + radius) / m_cell);
+        long long j0 = (long long)std::floor((y - radius) / m_cell);
+        long long j1 = (long long)std::floor((y + radius) / m_cell);
+
+        for (long long i = i0; i <= i1; ++i)
+        {
+          for (long long j = j0; j <= j1; ++j)
+          {
+            long long key = pack(i, j);
+            const std::vector<uint32_t>& ids = m_buckets[hash(key)];
+
+            for (size_t k = 0; k < ids.size(); ++k)
+            {
+              const Contact& c = m_contacts[m_index.find(ids[k])->second];
+              // Buckets are shared between cells with the same hash.
+              if (c.cell == key)
+                out.push_back(&c);
+            }
+          }
+        }
+      }
+
+      size_t
+      size(void) const
+      {
+        return m_contacts.size();
+      }
+
+      void
+      clear(void)
+      {
+        m_contacts.clear();
+        m_index.clear();
+        for (size_t i = 0; i < m_buckets.size(); ++i)
+          m_buckets[i].clear();
+      }
+
+    private:
+      //! Cell size (m).
+      double m_cell;
+      //! Contacts.
+      std::vector<Contact> m_contacts;
+      //! Position of each contact in m_contacts.
+      std::unordered_map<uint32_t, size_t> m_index;
+      //! Contact identifiers per hash bucket.
+      std::vector<std::vector<uint32_t> > m_buckets;
+
+      static long long
+      pack(long long i, long long j)
+      {
+        return (long long)((unsigned long long)i << 32) | (j & 0xffffffffLL);
+      }
+
+      long long
+      cellKey(double x, double y) const
+      {
+        return pack((long long)std::floor(x / m_cell), (long long)std::floor(y / m_cell));
+      }
+
+      size_t
+      hash(long long key) const
+      {
+        unsigned long long h = (unsigned long long)key * 0x9e3779b97f4a7c15ULL;
+        return (size_t)(h >> 32) & (m_buckets.size() - 1);
+      }
+
+      std::vector<uint32_t>&
+      bucket(long long key)
+      {
+        return m_buckets[hash(key)];
+      }
+
+      void
+      unlink(long long key, uint32_t id)
+      {
+        std::vector<uint32_t>& ids = bucket(key);
+        for (size_t k = 0; k < ids.size(); ++k)
+        {
+          if (ids[k] == id)
+          {
+            ids[k] = ids.back();
+            ids.pop_back();
+            return;
+          }
+        }
+      }
+    };
+
+    //! Velocity obstacle avoidance. Candidate velocities around the
+    //! desired one are checked against the predicted closest approach
+    //! to each contact, and the closest safe one is chosen.
+    class VelocityObstacle
+    {
+    public:
+      //! Constructor.
+      //! @param[in] radius minimum allowed passing distance (m).
+      //! @param[in] horizon prediction horizon (s).
+      VelocityObstacle(double radius = 15.0, double horizon = 60.0):
+        m_radius(radius),
+        m_horizon(horizon)
+      { }
+
+      //! Choose a safe velocity.
+      //! @param[in] x vehicle north position (m).
+      //! @param[in] y vehicle east position (m).
+      //! @param[in] now current time (s).
+      //! @param[in] heading desired heading (rad).
+      //! @param[in] speed desired speed (m/s).
+      //! @param[in] contacts nearby contacts.
+      //! @param[out] safe_heading chosen heading (rad).
+      //! @param[out] safe_speed chosen speed (m/s).
+      //! @return true if the desired velocity had to be changed.
+      bool
+      choose(double x, double y, double now, double heading, double speed,
+             const std::vector<const Contact*>& contacts,
+             double& safe_heading, double& safe_speed) const
+      {
+        safe_heading = heading;
+        safe_speed = speed;
+
+        if (contacts.empty() || clearance(x, y, now, heading, speed, contacts) >= m_radius)
+          return false;
+
+        static const double c_speed_factors[] = {1.0, 0.5};
+        double step = Math::c_pi / c_avoid_headings;
+        double best_clearance = -1.0;
+
+        // Prefer small deviations, full speed before reduced speed.
+        for (unsigned s = 0; s < 2; ++s)
+        {
+          double v = speed * c_speed_factors[s];
+
+          for (int k = 1; k <= c_avoid_headings; ++k)
+          {
+            for (int side = -1; side <= 1; side += 2)
+            {
+              double h = Angles::normalizeRadian(heading + side * k * step);
+              double d = clearance(x, y, now, h, v, contacts);
+
+              if (d >= m_radius)
+              {
+                safe_heading = h;
+                safe_speed = v;
+                return true;
+              }
+
+              if (d > best_clearance)
+              {
+                best_clearance = d;
+                safe_heading = h;
+                safe_speed = v;
+              }
+            }
+          }
+        }
+
+        // Nothing is safe, take the largest clearance.
+        return true;
+      }
+
+    private:
+      //! Minimum passing distance (m).
+      double m_radius;
+      //! Prediction horizon (s).
+      double m_horizon;
+
+      //! Smallest predicted distance to any contact.
+      double
+      clearance(double x, double y, double now, double heading, double speed,
+             const std::vector<const Contact*>& contacts) const
+      {
+        double vx = speed * std::cos(heading);
+        double vy = speed * std::sin(heading);
+        double closest = -1.0;
+
+        for (size_t i = 0; i < contacts.size(); ++i)
+        {
+          const Contact& c = *contacts[i];
+          double age = now - c.time;
+          double rx = c.x + c.vx * age - x;
+          double ry = c.y + c.vy * age - y;
+          double wx = vx - c.vx;
+          double wy = vy - c.vy;
+          double w2 = wx * wx + wy * wy;
+
+          double t = w2 > 1e-9 ? (rx * wx + ry * wy) / w2 : 0.0;
+          t = std::max(0.0, std::min(m_horizon, t));
+
+          double dx = rx - wx * t;
+          double dy = ry - wy * t;
+          double d = std::sqrt(dx * dx + dy * dy);
+
+          if (closest < 0.0 || d < closest)
+            closest = d;
+        }
+
+        return closest;
+      }
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,390 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_DEPTH_GRID_HPP_INCLUDED_
+#define MANEUVER_TEST_DEPTH_GRID_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Depth grid file magic number ("DGRD").
+    static const uint32_t c_depth_magic = 0x44524744;
+    //! Depth grid file format version.
+    static const uint16_t c_depth_version = 1;
+    //! Tiles are 2^c_depth_tile_bits cells wide.
+    static const unsigned c_depth_tile_bits = 6;
+    //! Cells per tile side.
+    static const unsigned c_depth_tile_side = 1u << c_depth_tile_bits;
+    //! Cells per tile.
+    static const unsigned c_depth_tile_cells = c_depth_tile_side * c_depth_tile_side;
+
+    //! Depth grid file header.
+    struct DepthGridHeader
+    {
+      uint32_t magic;
+      uint16_t version;
+      uint16_t tile_bits;
+      //! Cell size (m).
+      double cell;
+      //! Grid origin latitude (rad).
+      double lat0;
+      //! Grid origin longitude (rad).
+      double lon0;
+      //! Number of tiles that follow.
+      uint32_t tiles;
+      uint32_t reserved;
+    };
+
+    //! Square block of cells, allocated when first sampled.
+    struct DepthTile
+    {
+      //! Mean seabed depth (m).
+      float depth[c_depth_tile_cells];
+      //! Number of samples, saturating.
+      uint16_t count[c_depth_tile_cells];
+    };
+
+    //! Seabed depth map built from navigation data. Cells live in
+    //! sparse tiles keyed by tile coordinates in an equirectangular
+    //! frame around a fixed origin, so a sample costs a hash lookup
+    //! (skipped while it stays in the same tile) and a running mean
+    //! update. The map persists as a binary tile file.
+    class DepthGrid
+    {
+    public:
+      DepthGrid(void):
+        m_cell(2.0),
+        m_lat0(0.0),
+        m_lon0(0.0),
+        m_cos_lat0(1.0),
+        m_has_origin(false),
+        m_last_key(0),
+        m_last(NULL)
+      { }
+
+      ~DepthGrid(void)
+      {
+        clear();
+      }
+
+      //! Set cell size, the grid must be empty.
+      //! @param[in] cell cell size (m).
+      void
+      setCellSize(double cell)
+      {
+        if (m_tiles.empty() && cell > 0.0)
+          m_cell = cell;
+      }
+
+      //! Get cell size.
+      double
+      getCellSize(void) const
+      {
+        return m_cell;
+      }
+
+      //! Add a seabed depth sample.
+      //! @param[in] lat latitude (rad).
+      //! @param[in] lon longitude (rad).
+      //! @param[in] depth seabed depth (m).
+      void
+      update(double lat, double lon, float depth)
+      {
+        if (!m_has_origin)
+        {
+          m_lat0 = lat;
+          m_lon0 = lon;
+          m_cos_lat0 = std::cos(lat);
+          m_has_origin = true;
+        }
+
+        int64_t cx, cy;
+        toCell(lat, lon, cx, cy);
+
+        uint64_t key = getKey(cx, cy);
+        DepthTile* tile = m_last;
+        if (tile == NULL || key != m_last_key)
+        {
+          std::unordered_map<uint64_t, DepthTile*>::iterator itr = m_tiles.find(key);
+          if (itr == m_tiles.end())
+          {
+            tile = new DepthTile;
+            std::memset(tile, 0, sizeof(DepthTile));
+            m_tiles[key] = tile;
+          }
+          else
+          {
+            tile = itr->second;
+          }
+
+          m_last_key = key;
+          m_last = tile;
+        }
+
+        unsigned i = getIndex(cx, cy);
+        if (tile->count[i] < 0xffff)
+          ++tile->count[i];
+        tile->depth[i] += (depth - tile->depth[i]) / tile->count[i];
+      }
+
+      //! Get seabed depth at a position.
+      //! @param[in] lat latitude (rad).
+      //! @param[in] lon longitude (rad).
+      //! @param[out] depth mean seabed depth (m).
+      //! @return false if the cell was never sampled.
+      bool
+      query(double lat, double lon, float& depth) const
+      {
+        if (!m_has_origin)
+          return false;
+
+        int64_t cx, cy;
+        toCell(lat, lon, cx, cy);
+        return lookup(cx, cy, depth);
+      }
+
+      //! Inspect the cells along a leg.
+      //! @param[in] lat0 start latitude (rad).
+      //! @param[in] lon0 start longitude (rad).
+      //! @param[in] lat1 end latitude (rad).
+      //! @param[in] lon1 end longitude (rad).
+      //! @param[out] shallowest smallest known seabed depth (m).
+      //! @param[out] known fraction of the leg over sampled cells.
+      //! @return false if no cell along the leg was sampled.
+      bool
+      queryLeg(double lat0, double lon0, double lat1, double lon1,
+               float& shallowest, float& known) const
+      {
+        if (!m_has_origin)
+          return false;
+
+        double x0, y0, x1, y1;
+        toLocal(lat0, lon0, x0, y0);
+        toLocal(lat1, lon1, x1, y1);
+
+        double len = std::sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+        unsigned steps = (unsigned)std::ceil(len / m_cell) + 1;
+        unsigned hits = 0;
+
+        for (unsigned k = 0; k <= steps; ++k)
+        {
+          double t = (double)k / steps;
+          float depth;
+          if (!lookup((int64_t)std::floor((x0 + t * (x1 - x0)) / m_cell),
+                      (int64_t)std::floor((y0 + t * (y1 - y0)) / m_cell), depth))
+            continue;
+
+          shallowest = hits == 0 ? depth : std::min(shallowest, depth);
+          ++hits;
+        }
+
+        known = (float)hits / (steps + 1);
+        return hits > 0;
+      }
+
+      //! Number of allocated tiles.
+      size_t
+      getTiles(void) const
+      {
+        return m_tiles.size();
+      }
+
+      //! Drop all tiles.
+      void
+      clear(void)
+      {
+        std::unordered_map<uint64_t, DepthTile*>::iterator itr = m_tiles.begin();
+        for (; itr != m_tiles.end(); ++itr)
+          delete itr->second;
+
+        m_tiles.clear();
+        m_last = NULL;
+        m_has_origin = false;
+      }
+
+      //! Write the grid to a tile file.
+      //! @param[in] path file path.
+      void
+      save(const std::string& path) const
+      {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == NULL)
+          throw std::runtime_error(path + ": " + std::strerror(errno));
+
+        DepthGridHeader hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = c_depth_magic;
+        hdr.version = c_depth_version;
+        hdr.tile_bits = c_depth_tile_bits;
+        hdr.cell = m_cell;
+        hdr.lat0 = m_lat0;
+        hdr.lon0 = m_lon0;
+        hdr.tiles = m_tiles.size();
+
+        bool ok = std::fwrite(&hdr, sizeof(hdr), 1, file) == 1;
+
+        std::unordered_map<uint64_t, DepthTile*>::const_iterator itr = m_tiles.begin();
+        for (; ok && itr != m_tiles.end(); ++itr)
+        {
+          uint64_t key = itr->first;
+          ok = std::fwrite(&key, sizeof(key), 1, file) == 1
+          && std::fwrite(itr->second, sizeof(DepthTile), 1, file) == 1;
+        }
+
+        if (std::fclose(file) != 0 || !ok)
+          throw std::runtime_error(path + ": write failed");
+      }
+
+      //! Replace the grid by the contents of a tile file.
+      //! @param[in] path file path.
+      void
+      load(const std::string& path)
+      {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (file == NULL)
+          throw std::runtime_error(path + ": " + std::strerror(errno));
+
+        DepthGridHeader hdr;
+        if (std::fread(&hdr, sizeof(hdr), 1, file) != 1 || hdr.magic != c_depth_magic
+            || hdr.version != c_depth_version || hdr.tile_bits != c_depth_tile_bits)
+        {
+          std::fclose(file);
+          throw std::runtime_error(path + ": not a depth grid");
+        }
+
+        clear();
+        m_cell = hdr.cell;
+        m_lat0 = hdr.lat0;
+        m_lon0 = hdr.lon0;
+        m_cos_lat0 = std::cos(hdr.lat0);
+        m_has_origin = true;
+
+        for (uint32_t i = 0; i < hdr.tiles; ++i)
+        {
+          uint64_t key;
+          DepthTile* tile = new DepthTile;
+          if (std::fread(&key, sizeof(key), 1, file) != 1
+              || std::fread(tile, sizeof(DepthTile), 1, file) != 1)
+          {
+            delete tile;
+            std::fclose(file);
+            throw std::runtime_error(path + ": truncated depth grid");
+          }
+
+          m_tiles[key] = tile;
+        }
+
+        std::fclose(file);
+      }
+
+    private:
+      //! Cell size (m).
+      double m_cell;
+      //! Origin latitude (rad).
+      double m_lat0;
+      //! Origin longitude (rad).
+      double m_lon0;
+      //! Cosine of the origin latitude.
+      double m_cos_lat0;
+      //! True once the origin is set.
+      bool m_has_origin;
+      //! Key of the last updated tile.
+      uint64_t m_last_key;
+      //! Last updated tile.
+      DepthTile* m_last;
+      //! Allocated tiles.
+      std::unordered_map<uint64_t, DepthTile*> m_tiles;
+
+      void
+      toLocal(double lat, double lon, double& x, double& y) const
+      {
+        x = (lat - m_lat0) * c_wgs84_a;
+        y = (lon - m_lon0) * c_wgs84_a * m_cos_lat0;
+      }
+
+      void
+      toCell(double lat, double lon, int64_t& cx, int64_t& cy) const
+      {
+        double x, y;
+        toLocal(lat, lon, x, y);
+        cx = (int64_t)std::floor(x / m_cell);
+        cy = (int64_t)std::floor(y / m_cell);
+      }
+
+      static uint64_t
+      getKey(int64_t cx, int64_t cy)
+      {
+        // Arithmetic shift keeps negative tiles distinct.
+        uint32_t tx = (uint32_t)(int32_t)(cx >> c_depth_tile_bits);
+        uint32_t ty = (uint32_t)(int32_t)(cy >> c_depth_tile_bits);
+        return (uint64_t)tx << 32 | ty;
+      }
+
+      static unsigned
+      getIndex(int64_t cx, int64_t cy)
+      {
+        unsigned mask = c_depth_tile_side - 1;
+        return ((unsigned)cx & mask) << c_depth_tile_bits | ((unsigned)cy & mask);
+      }
+
+      bool
+      lookup(int64_t cx, int64_t cy, float& depth) const
+      {
+        std::unordered_map<uint64_t, DepthTile*>::const_iterator itr = m_tiles.find(getKey(cx, cy));
+        if (itr == m_tiles.end())
+          return false;
+
+        unsigned i = getIndex(cx, cy);
+        if (itr->second->count[i] == 0)
+          return false;
+
+        depth = itr->second->depth[i];
+        return true;
+      }
+    };
+  }
+}
+
+#endif
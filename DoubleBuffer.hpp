@@ -0,0 +1,137 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_DOUBLE_BUFFER_HPP_INCLUDED_
+#define MANEUVER_TEST_DOUBLE_BUFFER_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cstring>
+
+// ISO C++ 11 headers.
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Single writer, single reader double buffer guarded by a
+    //! sequence lock. The sequence number is odd while the writer
+    //! fills the back buffer and even once it became the front one,
+    //! so the reader can keep copying the front buffer meanwhile and
+    //! only retries if the writer started reusing it. Values are
+    //! copied through relaxed atomic words, so T must be trivially
+    //! copyable.
+    template <typename T>
+    class DoubleBuffer
+    {
+    public:
+      DoubleBuffer(void):
+        m_seq(0)
+      {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "DoubleBuffer needs a trivially copyable type");
+
+        for (unsigned b = 0; b < 2; ++b)
+        {
+          for (unsigned i = 0; i < c_words; ++i)
+            m_words[b][i].store(0, std::memory_order_relaxed);
+        }
+      }
+
+      //! Publish a new value. Writer side only.
+      //! @param[in] value value.
+      void
+      publish(const T& value)
+      {
+        unsigned seq = m_seq.load(std::memory_order_relaxed);
+        uint64_t words[c_words] = {0};
+        std::memcpy(words, &value, sizeof(T));
+
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        // Buffer writes must not become visible before the odd
+        // sequence number.
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::atomic<uint64_t>* back = m_words[(seq / 2 + 1) & 1];
+        for (unsigned i = 0; i < c_words; ++i)
+          back[i].store(words[i], std::memory_order_relaxed);
+
+        m_seq.store(seq + 2, std::memory_order_release);
+      }
+
+      //! Read the latest value if it changed since the last call.
+      //! Reader side only.
+      //! @param[in,out] seq sequence number of the last value read.
+      //! @param[out] value latest value.
+      //! @return true if a new value was read.
+      bool
+      read(unsigned& seq, T& value) const
+      {
+        while (true)
+        {
+          // While a publication is in progress the previous one is
+          // still the front buffer.
+          unsigned before = m_seq.load(std::memory_order_acquire) & ~1u;
+          if (before == seq)
+            return false;
+
+          uint64_t words[c_words];
+          const std::atomic<uint64_t>* front = m_words[(before / 2) & 1];
+          for (unsigned i = 0; i < c_words; ++i)
+            words[i] = front[i].load(std::memory_order_relaxed);
+
+          std::atomic_thread_fence(std::memory_order_acquire);
+
+          // The front buffer is only rewritten by the publication
+          // after the next one.
+          if (m_seq.load(std::memory_order_relaxed) - before <= 2)
+          {
+            std::memcpy(&value, words, sizeof(T));
+            seq = before;
+            return true;
+          }
+        }
+      }
+
+    private:
+      //! Number of words holding a value.
+      static const unsigned c_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+      //! Front and back buffers.
+      std::atomic<uint64_t> m_words[2][c_words];
+      //! Twice the number of publications, odd while one is in
+      //! progress. Bit 1 selects the front buffer.
+      std::atomic<unsigned> m_seq;
+    };
+  }
+}
+
+#endif
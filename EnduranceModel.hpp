@@ -0,0 +1,221 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_ENDURANCE_MODEL_HPP_INCLUDED_
+#define MANEUVER_TEST_ENDURANCE_MODEL_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Minimum time between model fits (s).
+    static const double c_energy_fit_interval = 60.0;
+    //! Forgetting factor applied at every fit.
+    static const double c_energy_forgetting = 0.98;
+    //! Initial and maximum parameter covariance.
+    static const double c_energy_covariance = 1.0;
+
+    //! Energy consumption model learned online from fuel level
+    //! reports. Consumption over an interval is modeled as a hotel
+    //! load plus a propulsion term proportional to the integral of
+    //! the cube of the speed through water, fitted by recursive least
+    //! squares. Every operation is constant time.
+    class EnduranceModel
+    {
+    public:
+      EnduranceModel(void)
+      {
+        reset();
+      }
+
+      //! Forget everything learned.
+      void
+      reset(void)
+      {
+        m_fuel = -1.0;
+        m_fit_fuel = -1.0;
+        m_fit_time = 0.0;
+        m_fit_dt = 0.0;
+        m_fit_work = 0.0;
+        m_last_time = -1.0;
+        m_fits = 0;
+        m_theta[0] = 0.0;
+        m_theta[1] = 0.0;
+        m_p[0][0] = c_energy_covariance;
+        m_p[0][1] = 0.0;
+        m_p[1][0] = 0.0;
+        m_p[1][1] = c_energy_covariance;
+        m_mean_rate = 0.0;
+      }
+
+      //! Accumulate motion between fuel reports.
+      //! @param[in] time sample time (s).
+      //! @param[in] u speed through water (m/s).
+      void
+      integrate(double time, double u)
+      {
+        if (m_last_time >= 0.0 && time > m_last_time && m_fit_fuel >= 0.0)
+        {
+          double dt = time - m_last_time;
+          u = std::fabs(u);
+          m_fit_dt += dt;
+          m_fit_work += u * u * u * dt;
+        }
+
+        m_last_time = time;
+      }
+
+      //! Feed a fuel level report.
+      //! @param[in] time report time (s).
+      //! @param[in] fuel fuel level (%).
+      void
+      update(double time, double fuel)
+      {
+        m_fuel = fuel;
+
+        // First report, or recharged: start a new interval.
+        if (m_fit_fuel < 0.0 || fuel > m_fit_fuel)
+        {
+          restart(time, fuel);
+          return;
+        }
+
+        // Coarse gauges report in steps, fitting on a step keeps the
+        // interval consumption unbiased.
+        double y = m_fit_fuel - fuel;
+        if (time - m_fit_time < c_energy_fit_interval || m_fit_dt <= 0.0 || y <= 0.0)
+          return;
+
+        double x0 = m_fit_dt;
+        double x1 = m_fit_work;
+
+        // Recursive least squares with forgetting.
+        double px0 = m_p[0][0] * x0 + m_p[0][1] * x1;
+        double px1 = m_p[1][0] * x0 + m_p[1][1] * x1;
+        double den = c_energy_forgetting + x0 * px0 + x1 * px1;
+        double k0 = px0 / den;
+        double k1 = px1 / den;
+        double err = y - (m_theta[0] * x0 + m_theta[1] * x1);
+
+        m_theta[0] += k0 * err;
+        m_theta[1] += k1 * err;
+
+        double p00 = (m_p[0][0] - k0 * px0) / c_energy_forgetting;
+        double p01 = (m_p[0][1] - k0 * px1) / c_energy_forgetting;
+        double p11 = (m_p[1][1] - k1 * px1) / c_energy_forgetting;
+
+        // A constant speed does not excite both parameters, keep the
+        // covariance from winding up.
+        double trace = p00 + p11;
+        if (trace > 2.0 * c_energy_covariance)
+        {
+          double scale = 2.0 * c_energy_covariance / trace;
+          p00 *= scale;
+          p01 *= scale;
+          p11 *= scale;
+        }
+
+        m_p[0][0] = p00;
+        m_p[0][1] = p01;
+        m_p[1][0] = p01;
+        m_p[1][1] = p11;
+
+        double rate = y / x0;
+        m_mean_rate = m_fits == 0 ? rate : m_mean_rate + 0.2 * (rate - m_mean_rate);
+        ++m_fits;
+
+        restart(time, fuel);
+      }
+
+      //! Check if the model can make predictions.
+      bool
+      isValid(void) const
+      {
+        return m_fits > 0;
+      }
+
+      //! Latest fuel level (%), negative if unknown.
+      double
+      getFuel(void) const
+      {
+        return m_fuel;
+      }
+
+      //! Predicted consumption rate.
+      //! @param[in] speed speed through water (m/s).
+      //! @return consumption rate (%/s).
+      double
+      getRate(double speed) const
+      {
+        double rate = m_theta[0] + m_theta[1] * speed * speed * speed;
+        // Fall back to the observed mean when the fit is not physical.
+        if (rate <= 0.0 || m_theta[0] < 0.0 || m_theta[1] < 0.0)
+          return m_mean_rate;
+
+        return rate;
+      }
+
+    private:
+      //! Latest fuel level (%).
+      double m_fuel;
+      //! Fuel level at the start of the fit interval (%).
+      double m_fit_fuel;
+      //! Start of the fit interval (s).
+      double m_fit_time;
+      //! Time integrated in the fit interval (s).
+      double m_fit_dt;
+      //! Integral of speed cubed in the fit interval (m^3/s^2).
+      double m_fit_work;
+      //! Last motion sample time (s).
+      double m_last_time;
+      //! Number of fits.
+      unsigned m_fits;
+      //! Hotel load (%/s) and propulsion coefficient (% s^2/m^3).
+      double m_theta[2];
+      //! Parameter covariance.
+      double m_p[2][2];
+      //! Smoothed observed consumption rate (%/s).
+      double m_mean_rate;
+
+      void
+      restart(double time, double fuel)
+      {
+        m_fit_fuel = fuel;
+        m_fit_time = time;
+        m_fit_dt = 0.0;
+        m_fit_work = 0.0;
+      }
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,268 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_FORMATION_HPP_INCLUDED_
+#define MANEUVER_TEST_FORMATION_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Turn rate under which the leader is predicted on a straight line (rad/s).
+    static const double c_formation_min_turn = 1e-4;
+
+    //! Leader navigation sample.
+    struct LeaderFix
+    {
+      //! Time the sample was taken, in task time (s).
+      double time;
+      //! Latitude (rad).
+      double lat;
+      //! Longitude (rad).
+      double lon;
+      //! Heading (rad).
+      double psi;
+      //! Ground velocity north (m/s).
+      double vx;
+      //! Ground velocity east (m/s).
+      double vy;
+      //! Turn rate (rad/s).
+      double r;
+    };
+
+    //! Formation slot of a follower, fixed in the leader body frame.
+    //! The leader is predicted from its last fix with constant speed
+    //! and turn rate, which covers the link delay and the time until
+    //! the next fix. The spacing error of the follower and the area
+    //! it covers while in its slot are measured along the way.
+    class FormationTracker
+    {
+    public:
+      FormationTracker(void):
+        m_forward(0.0),
+        m_starboard(0.0),
+        m_timeout(0.0),
+        m_has_fix(false)
+      {
+        reset();
+      }
+
+      //! Set slot and leader timeout.
+      //! @param[in] forward offset ahead of the leader (m).
+      //! @param[in] starboard offset to the right of the leader (m).
+      //! @param[in] timeout longest prediction before the leader is lost (s).
+      void
+      setup(double forward, double starboard, double timeout)
+      {
+        m_forward = forward;
+        m_starboard = starboard;
+        m_timeout = timeout;
+      }
+
+      //! Clear measurements.
+      void
+      reset(void)
+      {
+        m_start = -1.0;
+        m_last = -1.0;
+        m_error = 0.0;
+        m_sum2 = 0.0;
+        m_max = 0.0;
+        m_samples = 0;
+        m_area = 0.0;
+      }
+
+      //! Take a new leader fix. Fixes older than the last one are
+      //! ignored, links may reorder them.
+      //! @param[in] fix leader fix.
+      void
+      update(const LeaderFix& fix)
+      {
+        if (m_has_fix && fix.time <= m_fix.time)
+          return;
+
+        m_fix = fix;
+        m_has_fix = true;
+      }
+
+      //! Check if the leader can be predicted.
+      //! @param[in] time task time (s).
+      bool
+      isFresh(double time) const
+      {
+        return m_has_fix && time - m_fix.time <= m_timeout;
+      }
+
+      //! Predict the slot position.
+      //! @param[in] time task time (s).
+      //! @param[out] lat slot latitude (rad).
+      //! @param[out] lon slot longitude (rad).
+      //! @param[out] psi leader heading (rad).
+      //! @param[out] speed leader ground speed (m/s).
+      //! @return false if no leader fix was received.
+      bool
+      slot(double time, double& lat, double& lon, double& psi, double& speed) const
+      {
+        if (!m_has_fix)
+          return false;
+
+        double dt = std::max(0.0, time - m_fix.time);
+        double chi = std::atan2(m_fix.vy, m_fix.vx);
+        double dn, de;
+        speed = std::sqrt(m_fix.vx * m_fix.vx + m_fix.vy * m_fix.vy);
+
+        if (std::fabs(m_fix.r) < c_formation_min_turn)
+        {
+          dn = m_fix.vx * dt;
+          de = m_fix.vy * dt;
+        }
+        else
+        {
+          double turn = m_fix.r * dt;
+          dn = speed / m_fix.r * (std::sin(chi + turn) - std::sin(chi));
+          de = speed / m_fix.r * (std::cos(chi) - std::cos(chi + turn));
+        }
+
+        psi = m_fix.psi + m_fix.r * dt;
+        dn += m_forward * std::cos(psi) - m_starboard * std::sin(psi);
+        de += m_forward * std::sin(psi) + m_starboard * std::cos(psi);
+
+        lat = m_fix.lat;
+        lon = m_fix.lon;
+        WGS84::displace(dn, de, &lat, &lon);
+        return true;
+      }
+
+      //! Measure the follower against its slot.
+      //! @param[in] time task time (s).
+      //! @param[in] lat follower latitude (rad).
+      //! @param[in] lon follower longitude (rad).
+      //! @param[in] tolerance spacing error still counted as in slot (m).
+      //! @param[in] swath width covered by the follower (m).
+      //! @return false if the leader was lost.
+      bool
+      measure(double time, double lat, double lon, double tolerance, double swath)
+      {
+        double slat, slon, psi, speed;
+        if (!isFresh(time) || !slot(time, slat, slon, psi, speed))
+        {
+          m_last = -1.0;
+          return false;
+        }
+
+        m_error = WGS84::distance(lat, lon, 0.0, slat, slon, 0.0);
+        m_sum2 += m_error * m_error;
+        m_max = std::max(m_max, m_error);
+        ++m_samples;
+
+        if (m_start < 0.0)
+          m_start = time;
+
+        // The slot advances with the leader, count its swath when held.
+        if (m_last >= 0.0 && m_error <= tolerance)
+          m_area += swath * speed * (time - m_last);
+
+        m_last = time;
+        return true;
+      }
+
+      //! Last spacing error (m).
+      double
+      getError(void) const
+      {
+        return m_error;
+      }
+
+      //! Root mean square spacing error (m).
+      double
+      getErrorRms(void) const
+      {
+        return m_samples ? std::sqrt(m_sum2 / m_samples) : 0.0;
+      }
+
+      //! Largest spacing error (m).
+      double
+      getErrorMax(void) const
+      {
+        return m_max;
+      }
+
+      //! Area covered in slot (m^2).
+      double
+      getArea(void) const
+      {
+        return m_area;
+      }
+
+      //! Time since the first measurement (s).
+      double
+      getElapsed(double time) const
+      {
+        return m_start < 0.0 ? 0.0 : time - m_start;
+      }
+
+    private:
+      //! Slot offset ahead of the leader (m).
+      double m_forward;
+      //! Slot offset to the right of the leader (m).
+      double m_starboard;
+      //! Longest prediction (s).
+      double m_timeout;
+      //! Last leader fix.
+      LeaderFix m_fix;
+      //! True once a fix was received.
+      bool m_has_fix;
+      //! Time of the first measurement (s).
+      double m_start;
+      //! Time of the last measurement while the leader was known (s).
+      double m_last;
+      //! Last spacing error (m).
+      double m_error;
+      //! Sum of squared spacing errors (m^2).
+      double m_sum2;
+      //! Largest spacing error (m).
+      double m_max;
+      //! Number of measurements.
+      unsigned long m_samples;
+      //! Area covered in slot (m^2).
+      double m_area;
+    };
+  }
+}
+
+#endif
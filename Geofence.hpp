@@ -0,0 +1,543 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_GEOFENCE_HPP_INCLUDED_
+#define MANEUVER_TEST_GEOFENCE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Maximum number of grid cells along each axis.
+    static const unsigned c_fence_grid_max = 128;
+
+    //! Operating area made of a lease polygon and circular keep-out
+    //! zones (cages). Edges are binned into a uniform grid and every
+    //! cell knows whether its centre lies inside the polygon, so a
+    //! point test only looks at the edges of one cell and a segment
+    //! test only at the cells the segment crosses.
+    class Geofence
+    {
+    public:
+      Geofence(void):
+        m_lat0(0.0),
+        m_lon0(0.0),
+        m_cos_lat0(1.0),
+        m_nx(0),
+        m_ny(0),
+        m_cell(1.0)
+      { }
+
+      //! Define geofence.
+      //! @param[in] polygon lease polygon as latitude, longitude pairs (rad).
+      //! @param[in] keep_out keep-out circles as latitude, longitude (rad)
+      //! and radius (m) triples.
+      void
+      setup(const std::vector<double>& polygon, const std::vector<double>& keep_out)
+      {
+        m_poly.clear();
+        m_circles.clear();
+        m_nx = 0;
+        m_ny = 0;
+
+        if (polygon.size() < 6 && keep_out.size() < 3)
+          return;
+
+        if (polygon.size() >= 2)
+        {
+          m_lat0 = polygon[0];
+          m_lon0 = polygon[1];
+        }
+        else
+        {
+          m_lat0 = keep_out[0];
+          m_lon0 = keep_out[1];
+        }
+
+        m_cos_lat0 = std::cos(m_lat0);
+
+        for (size_t i = 0; i + 1 < polygon.size() && polygon.size() >= 6; i += 2)
+          m_poly.push_back(toLocal(polygon[i], polygon[i + 1]));
+
+        for (size_t i = 0; i + 2 < keep_out.size(); i += 3)
+        {
+          Circle c;
+          c.c = toLocal(keep_out[i], keep_out[i + 1]);
+          c.r = keep_out[i + 2];
+          m_circles.push_back(c);
+        }
+
+        buildGrid();
+      }
+
+      //! Check if the geofence restricts anything.
+      bool
+      isEnabled(void) const
+      {
+        return !m_poly.empty() || !m_circles.empty();
+      }
+
+      //! Check if a position is allowed.
+      //! @param[in] lat latitude (rad).
+      //! @param[in] lon longitude (rad).
+      //! @return true if inside the lease and outside every keep-out zone.
+      bool
+      contains(double lat, double lon) const
+      {
+        return contains(toLocal(lat, lon));
+      }
+
+      //! Check if a straight leg stays within the allowed area.
+      //! @param[in] lat1 start latitude (rad).
+      //! @param[in] lon1 start longitude (rad).
+      //! @param[in] lat2 end latitude (rad).
+      //! @param[in] lon2 end longitude (rad).
+      //! @return true if the leg crosses no boundary.
+      bool
+      isLegValid(double lat1, double lon1, double lat2, double lon2) const
+      {
+        Vec a = toLocal(lat1, lon1);
+        Vec b = toLocal(lat2, lon2);
+
+        for (size_t i = 0; i < m_circles.size(); ++i)
+        {
+          if (distanceToSegment(m_circles[i].c, a, b) < m_circles[i].r)
+            return false;
+        }
+
+        return m_poly.empty() || !crossesBoundary(a, b);
+      }
+
+      //! Move a position to the closest allowed position.
+      //! @param[in,out] lat latitude (rad).
+      //! @param[in,out] lon longitude (rad).
+      //! @param[in] margin distance kept from boundaries (m).
+      //! @return true if the resulting position is allowed.
+      bool
+      clamp(double& lat, double& lon, double margin) const
+      {
+        Vec p = toLocal(lat, lon);
+
+        if (!m_poly.empty() && !insidePolygon(p))
+        {
+          // Nearest point on the boundary, then keep going the same
+          // way for the margin, which leads inside.
+          Vec best = p;
+          double best_d = -1.0;
+          size_t best_edge = 0;
+
+          for (size_t i = 0; i < m_poly.size(); ++i)
+          {
+            Vec q = closestOnSegment(p, m_poly[i], m_poly[(i + 1) % m_poly.size()]);
+            double d = dist(p, q);
+            if (best_d < 0.0 || d < best_d)
+            {
+              best = q;
+              best_d = d;
+              best_edge = i;
+            }
+          }
+
+          Vec n;
+          if (best_d > 1e-6)
+          {
+            n.x = (best.x - p.x) / best_d;
+            n.y = (best.y - p.y) / best_d;
+          }
+          else
+          {
+            const Vec& a = m_poly[best_edge];
+            const Vec& b = m_poly[(best_edge + 1) % m_poly.size()];
+            double len = dist(a, b);
+            n.x = -(b.y - a.y) / len;
+            n.y = (b.x - a.x) / len;
+          }
+
+          p.x = best.x + n.x * margin;
+          p.y = best.y + n.y * margin;
+
+          if (!insidePolygon(p))
+          {
+            p.x = best.x - n.x * margin;
+            p.y = best.y - n.y * margin;
+          }
+        }
+
+        for (size_t i = 0; i < m_circles.size(); ++i)
+        {
+          const Circle& c = m_circles[i];
+          double d = dist(p, c.c);
+          if (d >= c.r)
+            continue;
+
+          // Push radially out of the zone.
+          double dx = d > 1e-6 ? (p.x - c.c.x) / d : 1.0;
+          double dy = d > 1e-6 ? (p.y - c.c.y) / d : 0.0;
+          p.x = c.c.x + dx * (c.r + margin);
+          p.y = c.c.y + dy * (c.r + margin);
+        }
+
+        toGeodetic(p, lat, lon);
+        return contains(p);
+      }
+
+    private:
+      //! Point in the local frame (m).
+      struct Vec
+      {
+        //! North (m).
+        double x;
+        //! East (m).
+        double y;
+      };
+
+      //! Keep-out circle.
+      struct Circle
+      {
+        Vec c;
+        double r;
+      };
+
+      //! Cell classification.
+      enum CellState
+      {
+        CELL_OUTSIDE,
+        CELL_INSIDE,
+        CELL_BOUNDARY
+      };
+
+      //! Reference latitude of the local frame (rad).
+      double m_lat0;
+      //! Reference longitude of the local frame (rad).
+      double m_lon0;
+      //! Cosine of reference latitude.
+      double m_cos_lat0;
+      //! Lease polygon vertices.
+      std::vector<Vec> m_poly;
+      //! Keep-out zones.
+      std::vector<Circle> m_circles;
+      //! Grid origin.
+      Vec m_min;
+      //! Grid cells along x.
+      unsigned m_nx;
+      //! Grid cells along y.
+      unsigned m_ny;
+      //! Cell size (m).
+      double m_cell;
+      //! State of each cell.
+      std::vector<uint8_t> m_state;
+      //! Whether each cell centre is inside the polygon.
+      std::vector<uint8_t> m_center_inside;
+      //! Offset of each cell's edge list in m_edges, plus one past the end.
+      std::vector<unsigned> m_offsets;
+      //! Edge indices, grouped per cell.
+      std::vector<unsigned> m_edges;
+
+      Vec
+      toLocal(double lat, double lon) const
+      {
+        Vec v;
+        v.x = (lat - m_lat0) * c_wgs84_a;
+        v.y = (lon - m_lon0) * c_wgs84_a * m_cos_lat0;
+        return v;
+      }
+
+      void
+      toGeodetic(const Vec& v, double& lat, double& lon) const
+      {
+        lat = m_lat0 + v.x / c_wgs84_a;
+        lon = m_lon0 + v.y / (c_wgs84_a * m_cos_lat0);
+      }
+
+      static double
+      dist(const Vec& a, const Vec& b)
+      {
+        return std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y));
+      }
+
+      static Vec
+      closestOnSegment(const Vec& p, const Vec& a, const Vec& b)
+      {
+        double dx = b.x - a.x;
+        double dy = b.y - a.y;
+        double len2 = dx * dx + dy * dy;
+        double t = len2 > 0.0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2 : 0.0;
+        t = std::max(0.0, std::min(1.0, t));
+        Vec q = {a.x + t * dx, a.y + t * dy};
+        return q;
+      }
+
+      static double
+      distanceToSegment(const Vec& p, const Vec& a, const Vec& b)
+      {
+        return dist(p, closestOnSegment(p, a, b));
+      }
+
+      static double
+      cross(const Vec& o, const Vec& a, const Vec& b)
+      {
+        return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+      }
+
+      //! Proper intersection test between segments ab and cd.
+      static bool
+      intersects(const Vec& a, const Vec& b, const Vec& c, const Vec& d)
+      {
+        double d1 = cross(c, d, a);
+        double d2 = cross(c, d, b);
+        double d3 = cross(a, b, c);
+        double d4 = cross(a, b, d);
+        return ((d1 > 0) != (d2 > 0)) && ((d3 > 0) != (d4 > 0));
+      }
+
+      //! Ray casting against every edge, used to classify cells.
+      bool
+      insideBruteForce(const Vec& p) const
+      {
+        bool inside = false;
+        for (size_t i = 0, j = m_poly.size() - 1; i < m_poly.size(); j = i++)
+        {
+          const Vec& a = m_poly[i];
+          const Vec& b = m_poly[j];
+          if ((a.y > p.y) != (b.y > p.y)
+              && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+            inside = !inside;
+        }
+
+        return inside;
+      }
+
+      bool
+      cellOf(const Vec& p, unsigned& i, unsigned& j) const
+      {
+        double fx = (p.x - m_min.x) / m_cell;
+        double fy = (p.y - m_min.y) / m_cell;
+        if (fx < 0.0 || fy < 0.0 || fx >= m_nx || fy >= m_ny)
+          return false;
+
+        i = (unsigned)fx;
+        j = (unsigned)fy;
+        return true;
+      }
+
+      Vec
+      cellCenter(unsigned i, unsigned j) const
+      {
+        Vec c = {m_min.x + (i + 0.5) * m_cell, m_min.y + (j + 0.5) * m_cell};
+        return c;
+      }
+
+      bool
+      insidePolygon(const Vec& p) const
+      {
+        unsigned i, j;
+        if (!cellOf(p, i, j))
+          return false;
+
+        unsigned cell = i * m_ny + j;
+        if (m_state[cell] != CELL_BOUNDARY)
+          return m_state[cell] == CELL_INSIDE;
+
+        // Walk from the cell centre, whose side is known, to the
+        // point. Only edges of this cell can be crossed on the way.
+        Vec c = cellCenter(i, j);
+        bool inside = m_center_inside[cell] != 0;
+        for (unsigned k = m_offsets[cell]; k < m_offsets[cell + 1]; ++k)
+        {
+          unsigned e = m_edges[k];
+          if (intersects(c, p, m_poly[e], m_poly[(e + 1) % m_poly.size()]))
+            inside = !inside;
+        }
+
+        return inside;
+      }
+
+      bool
+      contains(const Vec& p) const
+      {
+        if (!m_poly.empty() && !insidePolygon(p))
+          return false;
+
+        for (size_t i = 0; i < m_circles.size(); ++i)
+        {
+          if (dist(p, m_circles[i].c) < m_circles[i].r)
+            return false;
+        }
+
+        return true;
+      }
+
+      //! Check if a segment crosses a polygon edge, visiting only the
+      //! grid cells along the segment.
+      bool
+      crossesBoundary(const Vec& a, const Vec& b) const
+      {
+        unsigned i, j, ie, je;
+        if (!cellOf(a, i, j) || !cellOf(b, ie, je))
+          return true;
+
+        // Grid traversal (Amanatides & Woo).
+        double dx = b.x - a.x;
+        double dy = b.y - a.y;
+        int si = dx > 0 ? 1 : -1;
+        int sj = dy > 0 ? 1 : -1;
+        double inf = std::numeric_limits<double>::infinity();
+        double bx = m_min.x + (i + (si > 0 ? 1 : 0)) * m_cell;
+        double by = m_min.y + (j + (sj > 0 ? 1 : 0)) * m_cell;
+        double tx = dx != 0.0 ? (bx - a.x) / dx : inf;
+        double ty = dy != 0.0 ? (by - a.y) / dy : inf;
+        double dtx = dx != 0.0 ? m_cell / std::fabs(dx) : inf;
+        double dty = dy != 0.0 ? m_cell / std::fabs(dy) : inf;
+
+        while (true)
+        {
+          unsigned cell = i * m_ny + j;
+          if (m_state[cell] == CELL_BOUNDARY)
+          {
+            for (unsigned k = m_offsets[cell]; k < m_offsets[cell + 1]; ++k)
+            {
+              unsigned e = m_edges[k];
+              if (intersects(a, b, m_poly[e], m_poly[(e + 1) % m_poly.size()]))
+                return true;
+            }
+          }
+
+          if ((i == ie && j == je) || (tx > 1.0 && ty > 1.0))
+            return false;
+
+          if (tx < ty)
+          {
+            tx += dtx;
+            i += si;
+          }
+          else
+          {
+            ty += dty;
+            j += sj;
+          }
+
+          if (i >= m_nx || j >= m_ny)
+            return false;
+        }
+      }
+
+      //! Bin polygon edges into the acceleration grid.
+      void
+      buildGrid(void)
+      {
+        if (m_poly.empty())
+          return;
+
+        Vec max = m_poly[0];
+        m_min = m_poly[0];
+        for (size_t i = 1; i < m_poly.size(); ++i)
+        {
+          m_min.x = std::min(m_min.x, m_poly[i].x);
+          m_min.y = std::min(m_min.y, m_poly[i].y);
+          max.x = std::max(max.x, m_poly[i].x);
+          max.y = std::max(max.y, m_poly[i].y);
+        }
+
+        // Pad so that boundary points fall inside the grid.
+        m_min.x -= 1.0;
+        m_min.y -= 1.0;
+        max.x += 1.0;
+        max.y += 1.0;
+
+        double span = std::max(max.x - m_min.x, max.y - m_min.y);
+        unsigned target = (unsigned)std::sqrt((double)m_poly.size()) * 4 + 4;
+        target = std::min(target, c_fence_grid_max);
+        m_cell = span / target;
+        m_nx = (unsigned)std::ceil((max.x - m_min.x) / m_cell);
+        m_ny = (unsigned)std::ceil((max.y - m_min.y) / m_cell);
+
+        unsigned cells = m_nx * m_ny;
+        std::vector<std::vector<unsigned> > bins(cells);
+
+        for (unsigned e = 0; e < m_poly.size(); ++e)
+        {
+          const Vec& a = m_poly[e];
+          const Vec& b = m_poly[(e + 1) % m_poly.size()];
+
+          // Conservative binning: every cell overlapped by the
+          // edge's bounding box that the edge passes near.
+          unsigned i0 = (unsigned)((std::min(a.x, b.x) - m_min.x) / m_cell);
+          unsigned i1 = (unsigned)((std::max(a.x, b.x) - m_min.x) / m_cell);
+          unsigned j0 = (unsigned)((std::min(a.y, b.y) - m_min.y) / m_cell);
+          unsigned j1 = (unsigned)((std::max(a.y, b.y) - m_min.y) / m_cell);
+
+          for (unsigned i = i0; i <= i1 && i < m_nx; ++i)
+          {
+            for (unsigned j = j0; j <= j1 && j < m_ny; ++j)
+            {
+              Vec c = cellCenter(i, j);
+              if (distanceToSegment(c, a, b) <= m_cell * 0.7072)
+                bins[i * m_ny + j].push_back(e);
+            }
+          }
+        }
+
+        m_state.assign(cells, CELL_OUTSIDE);
+        m_center_inside.assign(cells, 0);
+        m_offsets.assign(cells + 1, 0);
+        m_edges.clear();
+
+        for (unsigned cell = 0; cell < cells; ++cell)
+        {
+          Vec c = cellCenter(cell / m_ny, cell % m_ny);
+          bool inside = insideBruteForce(c);
+          m_center_inside[cell] = inside;
+
+          if (!bins[cell].empty())
+            m_state[cell] = CELL_BOUNDARY;
+          else
+            m_state[cell] = inside ? CELL_INSIDE : CELL_OUTSIDE;
+
+          m_offsets[cell] = m_edges.size();
+          m_edges.insert(m_edges.end(), bins[cell].begin(), bins[cell].end());
+        }
+
+        m_offsets[cells] = m_edges.size();
+      }
+    };
+  }
+}
+
+#endif
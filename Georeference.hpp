@@ -0,0 +1,518 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_GEOREFERENCE_HPP_INCLUDED_
+#define MANEUVER_TEST_GEOREFERENCE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <stdint.h>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Largest pose gap samples are interpolated across (s).
+    static const double c_georef_max_gap = 2.0;
+
+    //! Vehicle pose at a point in time.
+    struct PoseFix
+    {
+      //! Time (s).
+      double time;
+      //! Latitude (rad).
+      double lat;
+      //! Longitude (rad).
+      double lon;
+      //! Depth (m).
+      float depth;
+      //! Heading (rad).
+      float psi;
+    };
+
+    //! Payload sample tagged with the vehicle pose.
+    struct GeoSample
+    {
+      //! Pose at the sample time.
+      PoseFix pose;
+      //! IMC message identifier of the sample.
+      uint16_t type;
+      //! Source entity.
+      uint16_t entity;
+      //! Sample value.
+      float value;
+    };
+
+    //! Fixed capacity, time ordered ring of recent poses.
+    class PoseHistory
+    {
+    public:
+      //! Constructor.
+      //! @param[in] capacity number of poses kept, rounded up to a power of two.
+      PoseHistory(unsigned capacity = 1024):
+        m_head(0),
+        m_size(0)
+      {
+        unsigned size = 2;
+        while (size < capacity)
+          size <<= 1;
+
+        m_fixes.resize(size);
+      }
+
+      //! Add a pose, ignored unless newer than the newest one.
+      //! @param[in] fix pose.
+      //! @return true if the pose was added.
+      bool
+      push(const PoseFix& fix)
+      {
+        if (m_size > 0 && fix.time <= newest().time)
+          return false;
+
+        m_fixes[(m_head + m_size) & mask()] = fix;
+        if (m_size < m_fixes.size())
+          ++m_size;
+        else
+          m_head = (m_head + 1) & mask();
+
+        return true;
+      }
+
+      //! Interpolate the pose at a given time. Positions are linear,
+      //! heading follows the shortest arc.
+      //! @param[in] time time (s).
+      //! @param[out] fix interpolated pose.
+      //! @return false if the time is not bracketed by poses close enough.
+      bool
+      interpolate(double time, PoseFix& fix) const
+      {
+        if (m_size < 2 || time < oldest().time || time > newest().time)
+          return false;
+
+        // First pose newer than time.
+        size_t lo = 1;
+        size_t hi = m_size - 1;
+        while (lo < hi)
+        {
+          size_t mid = (lo + hi) / 2;
+          if (at(mid).time < time)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+        const PoseFix& a = at(lo - 1);
+        const PoseFix& b = at(lo);
+        double span = b.time - a.time;
+        if (span > c_georef_max_gap)
+          return false;
+
+        double t = (time - a.time) / span;
+        fix.time = time;
+        fix.lat = a.lat + t * (b.lat - a.lat);
+        fix.lon = a.lon + t * (b.lon - a.lon);
+        fix.depth = a.depth + t * (b.depth - a.depth);
+        fix.psi = normalize(a.psi + t * normalize(b.psi - a.psi));
+        return true;
+      }
+
+      //! Oldest pose, history must not be empty.
+      const PoseFix&
+      oldest(void) const
+      {
+        return at(0);
+      }
+
+      //! Newest pose, history must not be empty.
+      const PoseFix&
+      newest(void) const
+      {
+        return at(m_size - 1);
+      }
+
+      bool
+      empty(void) const
+      {
+        return m_size == 0;
+      }
+
+    private:
+      //! Pose storage, size is a power of two.
+      std::vector<PoseFix> m_fixes;
+      //! Position of the oldest pose.
+      size_t m_head;
+      //! Number of poses.
+      size_t m_size;
+
+      size_t
+      mask(void) const
+      {
+        return m_fixes.size() - 1;
+      }
+
+      const PoseFix&
+      at(size_t i) const
+      {
+        return m_fixes[(m_head + i) & mask()];
+      }
+
+      static double
+      normalize(double a)
+      {
+        return std::atan2(std::sin(a), std::cos(a));
+      }
+    };
+
+    //! Writes tagged samples as one little endian binary file per
+    //! field, in batches, with a schema.txt in the same layout as
+    //! the telemetry exporter.
+    class GeoColumnWriter
+    {
+    public:
+      GeoColumnWriter(void):
+        m_batch(4096),
+        m_total(0)
+      {
+        for (unsigned i = 0; i < c_columns; ++i)
+          m_files[i] = NULL;
+      }
+
+      ~GeoColumnWriter(void)
+      {
+        close();
+      }
+
+      //! Create column files.
+      //! @param[in] dir output directory, must exist.
+      //! @param[in] batch samples buffered before writing.
+      void
+      open(const std::string& dir, unsigned batch)
+      {
+        close();
+
+        m_dir = dir;
+        m_batch = batch > 0 ? batch : 1;
+        m_total = 0;
+
+        for (unsigned i = 0; i < c_columns; ++i)
+        {
+          std::string path = dir + "/" + getName(i) + "." + getType(i);
+          m_files[i] = std::fopen(path.c_str(), "wb");
+          if (m_files[i] == NULL)
+          {
+            int error = errno;
+            close();
+            throw std::runtime_error(path + ": " + std::strerror(error));
+          }
+        }
+
+        m_time.reserve(m_batch);
+        m_lat.reserve(m_batch);
+        m_lon.reserve(m_batch);
+        m_depth.reserve(m_batch);
+        m_psi.reserve(m_batch);
+        m_type.reserve(m_batch);
+        m_entity.reserve(m_batch);
+        m_value.reserve(m_batch);
+      }
+
+      //! Buffer a sample, writing the batch once full.
+      void
+      append(const GeoSample& s)
+      {
+        if (!isOpen())
+          return;
+
+        m_time.push_back(s.pose.time);
+        m_lat.push_back(s.pose.lat);
+        m_lon.push_back(s.pose.lon);
+        m_depth.push_back(s.pose.depth);
+        m_psi.push_back(s.pose.psi);
+        m_type.push_back(s.type);
+        m_entity.push_back(s.entity);
+        m_value.push_back(s.value);
+
+        if (m_time.size() >= m_batch)
+          flush();
+      }
+
+      //! Write buffered samples.
+      void
+      flush(void)
+      {
+        if (!isOpen() || m_time.empty())
+          return;
+
+        write(0, m_time);
+        write(1, m_lat);
+        write(2, m_lon);
+        write(3, m_depth);
+        write(4, m_psi);
+        write(5, m_type);
+        write(6, m_entity);
+        write(7, m_value);
+        m_total += m_time.size();
+
+        m_time.clear();
+        m_lat.clear();
+        m_lon.clear();
+        m_depth.clear();
+        m_psi.clear();
+        m_type.clear();
+        m_entity.clear();
+        m_value.clear();
+
+        writeSchema();
+      }
+
+      //! Flush and close column files.
+      void
+      close(void)
+      {
+        if (!isOpen())
+          return;
+
+        flush();
+        for (unsigned i = 0; i < c_columns; ++i)
+        {
+          if (m_files[i] != NULL)
+            std::fclose(m_files[i]);
+          m_files[i] = NULL;
+        }
+      }
+
+      bool
+      isOpen(void) const
+      {
+        return m_files[c_columns - 1] != NULL;
+      }
+
+      //! Number of samples written.
+      unsigned long
+      getTotal(void) const
+      {
+        return m_total;
+      }
+
+    private:
+      static const unsigned c_columns = 8;
+
+      //! Output directory.
+      std::string m_dir;
+      //! Column files.
+      std::FILE* m_files[c_columns];
+      //! Samples per batch.
+      unsigned m_batch;
+      //! Samples written so far.
+      unsigned long m_total;
+      //! Buffered columns.
+      std::vector<double> m_time;
+      std::vector<double> m_lat;
+      std::vector<double> m_lon;
+      std::vector<float> m_depth;
+      std::vector<float> m_psi;
+      std::vector<uint16_t> m_type;
+      std::vector<uint16_t> m_entity;
+      std::vector<float> m_value;
+
+      static const char*
+      getName(unsigned column)
+      {
+        static const char* const names[c_columns] =
+        {
+          "time", "lat", "lon", "depth", "psi", "type", "entity", "value"
+        };
+
+        return names[column];
+      }
+
+      static const char*
+      getType(unsigned column)
+      {
+        static const char* const types[c_columns] =
+        {
+          "f64", "f64", "f64", "f32", "f32", "u16", "u16", "f32"
+        };
+
+        return types[column];
+      }
+
+      template <typename T>
+      void
+      write(unsigned column, const std::vector<T>& values)
+      {
+        std::fwrite(&values[0], sizeof(T), values.size(), m_files[column]);
+        std::fflush(m_files[column]);
+      }
+
+      void
+      writeSchema(void) const
+      {
+        std::string path = m_dir + "/schema.txt";
+        std::FILE* schema = std::fopen(path.c_str(), "w");
+        if (schema == NULL)
+          return;
+
+        for (unsigned i = 0; i < c_columns; ++i)
+          std::fprintf(schema, "%s %s %lu\n", getName(i), getType(i), m_total);
+        std::fclose(schema);
+      }
+    };
+
+    //! Streaming georeferencing of payload samples. Samples newer than
+    //! the latest pose wait in a bounded queue until the pose that
+    //! brackets them arrives.
+    class Georeferencer
+    {
+    public:
+      //! Constructor.
+      //! @param[in] history number of poses kept.
+      //! @param[in] pending maximum number of samples waiting for a pose.
+      Georeferencer(unsigned history = 1024, unsigned pending = 4096):
+        m_poses(history),
+        m_pending(pending),
+        m_pending_head(0),
+        m_pending_size(0),
+        m_tagged(0),
+        m_dropped(0)
+      { }
+
+      //! Output columns.
+      GeoColumnWriter&
+      output(void)
+      {
+        return m_out;
+      }
+
+      //! Add a pose and tag the samples it brackets.
+      void
+      addPose(const PoseFix& fix)
+      {
+        if (!m_poses.push(fix))
+          return;
+
+        while (m_pending_size > 0)
+        {
+          GeoSample& s = m_pending[m_pending_head];
+          if (s.pose.time > fix.time)
+            break;
+
+          tag(s);
+          m_pending_head = (m_pending_head + 1) % m_pending.size();
+          --m_pending_size;
+        }
+      }
+
+      //! Add a payload sample.
+      //! @param[in] time sample time (s).
+      //! @param[in] type IMC message identifier.
+      //! @param[in] entity source entity.
+      //! @param[in] value sample value.
+      void
+      addSample(double time, uint16_t type, uint16_t entity, float value)
+      {
+        GeoSample s;
+        s.pose.time = time;
+        s.type = type;
+        s.entity = entity;
+        s.value = value;
+
+        if (!m_poses.empty() && time <= m_poses.newest().time && m_pending_size == 0)
+        {
+          tag(s);
+          return;
+        }
+
+        if (m_pending_size == m_pending.size())
+        {
+          // Navigation stalled, make room by giving up on the oldest.
+          m_pending_head = (m_pending_head + 1) % m_pending.size();
+          --m_pending_size;
+          ++m_dropped;
+        }
+
+        m_pending[(m_pending_head + m_pending_size) % m_pending.size()] = s;
+        ++m_pending_size;
+      }
+
+      //! Number of samples written with a pose.
+      unsigned long
+      getTagged(void) const
+      {
+        return m_tagged;
+      }
+
+      //! Number of samples that could not be georeferenced.
+      unsigned long
+      getDropped(void) const
+      {
+        return m_dropped;
+      }
+
+    private:
+      //! Recent poses.
+      PoseHistory m_poses;
+      //! Samples waiting for a newer pose.
+      std::vector<GeoSample> m_pending;
+      //! Oldest waiting sample.
+      size_t m_pending_head;
+      //! Number of waiting samples.
+      size_t m_pending_size;
+      //! Column output.
+      GeoColumnWriter m_out;
+      //! Samples written.
+      unsigned long m_tagged;
+      //! Samples dropped.
+      unsigned long m_dropped;
+
+      void
+      tag(GeoSample& s)
+      {
+        if (!m_poses.interpolate(s.pose.time, s.pose))
+        {
+          ++m_dropped;
+          return;
+        }
+
+        m_out.append(s);
+        ++m_tagged;
+      }
+    };
+  }
+}
+
+#endif
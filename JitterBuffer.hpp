@@ -0,0 +1,375 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_JITTER_BUFFER_HPP_INCLUDED_
+#define MANEUVER_TEST_JITTER_BUFFER_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Consecutive gate rejections after which the gate starts over
+    //! from the next sample, to recover from a genuine position reset.
+    static const unsigned c_gate_reseed = 5;
+
+    //! Fixed capacity buffer that puts samples arriving over a lossy
+    //! link back in timestamp order. A sample is released once a
+    //! sample taken at least the latency bound later arrived, or once
+    //! it waited that long itself, so no clock has to be shared with
+    //! the sender. Duplicates and samples older than the last one
+    //! released are dropped.
+    template <typename T>
+    class JitterBuffer
+    {
+    public:
+      //! Constructor.
+      //! @param[in] capacity maximum number of samples held.
+      JitterBuffer(unsigned capacity = 16):
+        m_latency(0.0)
+      {
+        setCapacity(capacity);
+      }
+
+      //! Change capacity, dropping held samples.
+      //! @param[in] capacity maximum number of samples held.
+      void
+      setCapacity(unsigned capacity)
+      {
+        // One spare entry lets a full buffer take a sample before
+        // the oldest one is forced out by pop().
+        m_capacity = capacity < 1 ? 1 : capacity;
+        m_entries.resize(m_capacity + 1);
+        clear();
+      }
+
+      //! Set latency bound.
+      //! @param[in] latency longest time a sample is held (s).
+      void
+      setLatency(double latency)
+      {
+        m_latency = latency;
+      }
+
+      //! Drop held samples and forget the last one released.
+      void
+      clear(void)
+      {
+        m_size = 0;
+        m_released = false;
+        m_last = 0.0;
+        m_has_newest = false;
+        m_newest = 0.0;
+        m_reordered = 0;
+        m_duplicates = 0;
+        m_stale = 0;
+        m_forced = 0;
+      }
+
+      //! Add a sample.
+      //! @param[in] stamp time the sample was taken (s).
+      //! @param[in] value sample.
+      //! @param[in] now local time (s).
+      //! @return false if the sample was dropped.
+      bool
+      push(double stamp, const T& value, double now)
+      {
+        if (m_released && stamp <= m_last)
+        {
+          if (stamp == m_last)
+            ++m_duplicates;
+          else
+            ++m_stale;
+          return false;
+        }
+
+        // Held samples are sorted oldest first.
+        size_t i = m_size;
+        while (i > 0 && m_entries[i - 1].stamp > stamp)
+          --i;
+
+        if (i > 0 && m_entries[i - 1].stamp == stamp)
+        {
+          ++m_duplicates;
+          return false;
+        }
+
+        if (i < m_size)
+          ++m_reordered;
+
+        // Still full because pop() was not called, drop the oldest.
+        if (m_size == m_entries.size())
+        {
+          if (i == 0)
+          {
+            ++m_stale;
+            return false;
+          }
+
+          shift(0, 1, --i);
+          --m_size;
+          ++m_stale;
+        }
+
+        for (size_t j = m_size; j > i; --j)
+          m_entries[j] = m_entries[j - 1];
+
+        m_entries[i].stamp = stamp;
+        m_entries[i].arrival = now;
+        m_entries[i].value = value;
+        ++m_size;
+
+        if (!m_has_newest || stamp > m_newest)
+        {
+          m_newest = stamp;
+          m_has_newest = true;
+        }
+
+        return true;
+      }
+
+      //! Take the oldest sample if it is due.
+      //! @param[in] now local time (s).
+      //! @param[out] value sample.
+      //! @return false if no sample is due.
+      bool
+      pop(double now, T& value)
+      {
+        if (m_size == 0)
+          return false;
+
+        const Entry& e = m_entries[0];
+        if (m_size > m_capacity)
+          ++m_forced;
+        else if (m_newest - e.stamp < m_latency && now - e.arrival < m_latency)
+          return false;
+
+        release(e, value);
+        shift(0, 1, m_size - 1);
+        --m_size;
+        return true;
+      }
+
+      //! Number of samples held.
+      size_t
+      size(void) const
+      {
+        return m_size;
+      }
+
+      //! Number of samples that arrived out of order.
+      unsigned long
+      getReordered(void) const
+      {
+        return m_reordered;
+      }
+
+      //! Number of duplicate samples dropped.
+      unsigned long
+      getDuplicates(void) const
+      {
+        return m_duplicates;
+      }
+
+      //! Number of samples dropped for arriving too late.
+      unsigned long
+      getStale(void) const
+      {
+        return m_stale;
+      }
+
+      //! Number of samples released early because the buffer was full.
+      unsigned long
+      getForced(void) const
+      {
+        return m_forced;
+      }
+
+    private:
+      //! Held sample.
+      struct Entry
+      {
+        //! Time the sample was taken (s).
+        double stamp;
+        //! Local time the sample arrived (s).
+        double arrival;
+        //! Sample.
+        T value;
+      };
+
+      //! Samples, oldest first.
+      std::vector<Entry> m_entries;
+      //! Maximum number of samples held.
+      size_t m_capacity;
+      //! Number of held samples.
+      size_t m_size;
+      //! Latency bound (s).
+      double m_latency;
+      //! True once a sample was released.
+      bool m_released;
+      //! Timestamp of the last sample released (s).
+      double m_last;
+      //! True once a sample was held.
+      bool m_has_newest;
+      //! Newest timestamp seen (s).
+      double m_newest;
+      //! Samples that arrived out of order.
+      unsigned long m_reordered;
+      //! Duplicates dropped.
+      unsigned long m_duplicates;
+      //! Late samples dropped.
+      unsigned long m_stale;
+      //! Samples released early.
+      unsigned long m_forced;
+
+      //! Move entries [from, from + count) to dst.
+      void
+      shift(size_t dst, size_t from, size_t count)
+      {
+        for (size_t j = 0; j < count; ++j)
+          m_entries[dst + j] = m_entries[from + j];
+      }
+
+      //! Hand out a sample and remember its timestamp.
+      void
+      release(const Entry& e, T& value)
+      {
+        value = e.value;
+        m_last = e.stamp;
+        m_released = true;
+      }
+    };
+
+    //! Rejects position fixes that would need the vehicle to move
+    //! faster than it can. Positions are compared on a local flat
+    //! approximation, which is plenty at the distances involved.
+    class KinematicGate
+    {
+    public:
+      KinematicGate(void):
+        m_max_speed(0.0),
+        m_margin(0.0),
+        m_stamp(0.0),
+        m_lat(0.0),
+        m_lon(0.0),
+        m_cos_lat(1.0)
+      {
+        clear();
+      }
+
+      //! Set limits.
+      //! @param[in] max_speed fastest plausible speed over ground (m/s).
+      //! @param[in] margin position noise allowance (m).
+      void
+      setup(double max_speed, double margin)
+      {
+        m_max_speed = max_speed;
+        m_margin = margin;
+      }
+
+      //! Start over from the next fix.
+      void
+      clear(void)
+      {
+        m_seeded = false;
+        m_rejects = 0;
+        m_rejected = 0;
+      }
+
+      //! Check a fix against the last accepted one.
+      //! @param[in] stamp time of the fix (s).
+      //! @param[in] lat latitude (rad).
+      //! @param[in] lon longitude (rad).
+      //! @return true if the fix is plausible.
+      bool
+      check(double stamp, double lat, double lon)
+      {
+        if (m_seeded && m_max_speed > 0.0)
+        {
+          double dn = (lat - m_lat) * c_wgs84_a;
+          double de = (lon - m_lon) * c_wgs84_a * m_cos_lat;
+          double reach = m_max_speed * (stamp - m_stamp) + m_margin;
+
+          if (dn * dn + de * de > reach * reach && ++m_rejects < c_gate_reseed)
+          {
+            ++m_rejected;
+            return false;
+          }
+        }
+
+        if (!m_seeded || std::fabs(lat - m_lat) > 1e-4)
+          m_cos_lat = std::cos(lat);
+
+        m_seeded = true;
+        m_rejects = 0;
+        m_stamp = stamp;
+        m_lat = lat;
+        m_lon = lon;
+        return true;
+      }
+
+      //! Number of fixes rejected.
+      unsigned long
+      getRejected(void) const
+      {
+        return m_rejected;
+      }
+
+    private:
+      //! Fastest plausible speed (m/s).
+      double m_max_speed;
+      //! Position noise allowance (m).
+      double m_margin;
+      //! True once a fix was accepted.
+      bool m_seeded;
+      //! Consecutive rejections.
+      unsigned m_rejects;
+      //! Total rejections.
+      unsigned long m_rejected;
+      //! Time of the last accepted fix (s).
+      double m_stamp;
+      //! Latitude of the last accepted fix (rad).
+      double m_lat;
+      //! Longitude of the last accepted fix (rad).
+      double m_lon;
+      //! Cosine of the latitude, refreshed when it moves.
+      double m_cos_lat;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,539 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_JOB_SCHEDULER_HPP_INCLUDED_
+#define MANEUVER_TEST_JOB_SCHEDULER_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Maximum number of local search passes per optimisation.
+    static const unsigned c_schedule_passes = 20;
+    //! Smallest travel saving worth a move (m).
+    static const double c_schedule_gain = 1e-3;
+
+    //! Plan to run once within a time window.
+    struct Job
+    {
+      //! Plan identifier.
+      std::string plan_id;
+      //! Northing of the job site (m).
+      double x;
+      //! Easting of the job site (m).
+      double y;
+      //! Expected plan duration (s).
+      double duration;
+      //! Earliest start time (s).
+      double open;
+      //! Latest start time (s).
+      double close;
+      //! Energy used by the plan itself (%).
+      double energy;
+    };
+
+    //! Orders and times jobs for a single vehicle. Jobs are inserted
+    //! one by one where they add the least travel, in order of their
+    //! closing time, and the order is then improved by moving single
+    //! jobs. Every route position keeps the largest delay it can
+    //! absorb without breaking a later window, so a candidate position
+    //! is checked in constant time.
+    class JobScheduler
+    {
+    public:
+      JobScheduler(void):
+        m_speed(1.0),
+        m_energy_rate(0.0),
+        m_time(0.0),
+        m_x(0.0),
+        m_y(0.0),
+        m_budget(0.0),
+        m_used(0.0),
+        m_late(0),
+        m_expired(0)
+      { }
+
+      //! Set vehicle model.
+      //! @param[in] speed transit speed (m/s).
+      //! @param[in] energy_rate transit energy (%/m).
+      void
+      setup(double speed, double energy_rate)
+      {
+        m_speed = speed;
+        m_energy_rate = energy_rate;
+      }
+
+      //! Forget all jobs.
+      void
+      clear(void)
+      {
+        m_jobs.clear();
+        m_route.clear();
+        m_pool.clear();
+        m_expired = 0;
+      }
+
+      //! Add a job, scheduled on the next plan() or replan().
+      //! @param[in] job job.
+      void
+      add(const Job& job)
+      {
+        m_pool.push_back(m_jobs.size());
+        m_jobs.push_back(job);
+      }
+
+      //! Build the schedule from scratch.
+      //! @param[in] time time the vehicle is free (s).
+      //! @param[in] x vehicle northing (m).
+      //! @param[in] y vehicle easting (m).
+      //! @param[in] energy energy available for the jobs (%).
+      void
+      plan(double time, double x, double y, double energy)
+      {
+        m_pool.insert(m_pool.end(), m_route.begin(), m_route.end());
+        m_route.clear();
+        replan(time, x, y, energy);
+      }
+
+      //! Re-time the schedule when the vehicle becomes free at another
+      //! time or place than planned, typically after a job overran.
+      //! Jobs that no longer fit are dropped, the order is improved
+      //! and dropped jobs are inserted again where they still fit.
+      //! @param[in] time time the vehicle is free (s).
+      //! @param[in] x vehicle northing (m).
+      //! @param[in] y vehicle easting (m).
+      //! @param[in] energy energy available for the jobs (%).
+      void
+      replan(double time, double x, double y, double energy)
+      {
+        m_time = time;
+        m_x = x;
+        m_y = y;
+        m_budget = energy;
+
+        while (!timeline())
+        {
+          m_pool.push_back(m_route[m_late]);
+          m_route.erase(m_route.begin() + m_late);
+        }
+
+        insertPool();
+        if (improve())
+          insertPool();
+      }
+
+      //! Check if a job is scheduled.
+      bool
+      empty(void) const
+      {
+        return m_route.empty();
+      }
+
+      //! Number of scheduled jobs.
+      size_t
+      size(void) const
+      {
+        return m_route.size();
+      }
+
+      //! Get a scheduled job.
+      //! @param[in] k position in the schedule.
+      const Job&
+      operator[](size_t k) const
+      {
+        return m_jobs[m_route[k]];
+      }
+
+      //! Planned start of a scheduled job (s).
+      //! @param[in] k position in the schedule.
+      double
+      getStart(size_t k) const
+      {
+        return m_start[k];
+      }
+
+      //! Latest time the plan of a scheduled job may be started so
+      //! that its transit ends at the planned start (s).
+      //! @param[in] k position in the schedule.
+      double
+      getDeparture(size_t k) const
+      {
+        return m_start[k] - travel(k) / m_speed;
+      }
+
+      //! Remove the first scheduled job, once its plan was started.
+      //! @return job.
+      Job
+      take(void)
+      {
+        Job job = m_jobs[m_route.front()];
+        m_route.erase(m_route.begin());
+        return job;
+      }
+
+      //! Number of jobs waiting for a slot.
+      size_t
+      getUnscheduled(void) const
+      {
+        return m_pool.size();
+      }
+
+      //! Number of jobs dropped because their window closed.
+      unsigned
+      getExpired(void) const
+      {
+        return m_expired;
+      }
+
+      //! Total transit distance of the schedule (m).
+      double
+      getDistance(void) const
+      {
+        double dist = 0.0;
+        for (size_t k = 0; k < m_route.size(); ++k)
+          dist += travel(k);
+        return dist;
+      }
+
+    private:
+      //! Jobs.
+      std::vector<Job> m_jobs;
+      //! Scheduled jobs in order.
+      std::vector<unsigned> m_route;
+      //! Jobs without a slot.
+      std::vector<unsigned> m_pool;
+      //! Arrival time per route position (s).
+      std::vector<double> m_arrive;
+      //! Start time per route position (s).
+      std::vector<double> m_start;
+      //! Largest arrival delay each route position absorbs (s).
+      std::vector<double> m_slack;
+      //! Transit speed (m/s).
+      double m_speed;
+      //! Transit energy (%/m).
+      double m_energy_rate;
+      //! Time the vehicle is free (s).
+      double m_time;
+      //! Vehicle northing when free (m).
+      double m_x;
+      //! Vehicle easting when free (m).
+      double m_y;
+      //! Energy available (%).
+      double m_budget;
+      //! Energy used by the schedule (%).
+      double m_used;
+      //! First infeasible position found by timeline().
+      size_t m_late;
+      //! Jobs dropped because their window closed.
+      unsigned m_expired;
+
+      //! Distance between two jobs, or from the vehicle when the first
+      //! one is negative.
+      double
+      distance(int a, unsigned b) const
+      {
+        double ax = a < 0 ? m_x : m_jobs[a].x;
+        double ay = a < 0 ? m_y : m_jobs[a].y;
+        double dx = m_jobs[b].x - ax;
+        double dy = m_jobs[b].y - ay;
+        return std::sqrt(dx * dx + dy * dy);
+      }
+
+      //! Job before a route position, negative for the vehicle.
+      int
+      before(size_t k) const
+      {
+        return k == 0 ? -1 : (int)m_route[k - 1];
+      }
+
+      //! Transit to a route position (m).
+      double
+      travel(size_t k) const
+      {
+        return distance(before(k), m_route[k]);
+      }
+
+      //! Time the vehicle leaves the job before a route position (s).
+      double
+      departure(size_t k) const
+      {
+        return k == 0 ? m_time : m_start[k - 1] + m_jobs[m_route[k - 1]].duration;
+      }
+
+      //! Compute times, energy and slack of the schedule.
+      //! @return false if a window or the energy budget is broken,
+      //! with m_late set to the offending position.
+      bool
+      timeline(void)
+      {
+        size_t n = m_route.size();
+        m_arrive.resize(n);
+        m_start.resize(n);
+        m_slack.resize(n);
+        m_used = 0.0;
+
+        for (size_t k = 0; k < n; ++k)
+        {
+          const Job& job = m_jobs[m_route[k]];
+          double dist = travel(k);
+          m_arrive[k] = departure(k) + dist / m_speed;
+          m_start[k] = std::max(m_arrive[k], job.open);
+          m_used += job.energy + m_energy_rate * dist;
+
+          if (m_start[k] > job.close)
+          {
+            m_late = k;
+            return false;
+          }
+        }
+
+        if (n > 0 && m_used > m_budget)
+        {
+          m_late = n - 1;
+          return false;
+        }
+
+        // A delay is first absorbed by waiting, then by the window.
+        double tail = 0.0;
+        for (size_t k = n; k-- > 0; )
+        {
+          double room = m_jobs[m_route[k]].close - m_start[k];
+          if (k + 1 < n)
+            room = std::min(room, tail);
+          tail = m_start[k] - m_arrive[k] + room;
+          m_slack[k] = tail;
+        }
+
+        return true;
+      }
+
+      //! Find the cheapest feasible position for a job.
+      //! @param[in] j job.
+      //! @param[out] best position.
+      //! @return false if the job fits nowhere.
+      bool
+      findSlot(unsigned j, size_t& best) const
+      {
+        const Job& job = m_jobs[j];
+        size_t n = m_route.size();
+        double best_cost = 0.0;
+        bool found = false;
+
+        for (size_t k = 0; k <= n; ++k)
+        {
+          double leave = departure(k);
+          // Departures only get later along the route.
+          if (leave > job.close)
+            break;
+
+          int prev = before(k);
+          double in = distance(prev, j);
+          double start = std::max(leave + in / m_speed, job.open);
+          if (start > job.close)
+            continue;
+
+          double cost = in;
+          if (k < n)
+          {
+            double out = distance(j, m_route[k]);
+            double delay = start + job.duration + out / m_speed - m_arrive[k];
+            if (delay > m_slack[k])
+              continue;
+
+            cost += out - travel(k);
+          }
+
+          if (m_used + job.energy + m_energy_rate * cost > m_budget)
+            continue;
+
+          if (!found || cost < best_cost)
+          {
+            best = k;
+            best_cost = cost;
+            found = true;
+          }
+        }
+
+        return found;
+      }
+
+      //! Insert waiting jobs by closing time where they add the least
+      //! travel. Jobs whose window already closed are dropped.
+      void
+      insertPool(void)
+      {
+        std::vector<std::pair<double, unsigned> > order;
+        for (size_t i = 0; i < m_pool.size(); ++i)
+        {
+          unsigned j = m_pool[i];
+          if (m_jobs[j].close < m_time)
+          {
+            ++m_expired;
+            continue;
+          }
+
+          order.push_back(std::make_pair(m_jobs[j].close, j));
+        }
+
+        std::sort(order.begin(), order.end());
+        m_pool.clear();
+
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+          size_t k;
+          if (!findSlot(order[i].second, k))
+          {
+            m_pool.push_back(order[i].second);
+            continue;
+          }
+
+          m_route.insert(m_route.begin() + k, order[i].second);
+          if (timeline())
+            continue;
+
+          // Rounding broke a window after all.
+          m_route.erase(m_route.begin() + k);
+          m_pool.push_back(order[i].second);
+          timeline();
+        }
+      }
+
+      //! Move single jobs to where they save travel, while every
+      //! window stays met.
+      //! @return true if the schedule changed.
+      bool
+      improve(void)
+      {
+        bool changed = false;
+
+        for (unsigned pass = 0; pass < c_schedule_passes; ++pass)
+        {
+          bool moved = false;
+
+          for (size_t p = 0; p < m_route.size(); ++p)
+          {
+            size_t q;
+            if (!findMove(p, q))
+              continue;
+
+            unsigned u = m_route[p];
+            size_t to = q > p ? q - 1 : q;
+            m_route.erase(m_route.begin() + p);
+            m_route.insert(m_route.begin() + to, u);
+            if (timeline())
+            {
+              moved = true;
+              continue;
+            }
+
+            m_route.erase(m_route.begin() + to);
+            m_route.insert(m_route.begin() + p, u);
+            timeline();
+          }
+
+          if (!moved)
+            break;
+
+          changed = true;
+        }
+
+        return changed;
+      }
+
+      //! Find a better position for a scheduled job. Times are taken
+      //! from the current schedule, which only makes the check stricter:
+      //! removing the job never delays the others.
+      //! @param[in] p current position.
+      //! @param[out] best new position, before the move.
+      //! @return true if moving saves travel.
+      bool
+      findMove(size_t p, size_t& best) const
+      {
+        size_t n = m_route.size();
+        unsigned u = m_route[p];
+        const Job& job = m_jobs[u];
+        int a = before(p);
+
+        double gain = travel(p);
+        if (p + 1 < n)
+          gain += distance(u, m_route[p + 1]) - distance(a, m_route[p + 1]);
+
+        double best_gain = c_schedule_gain;
+        bool found = false;
+
+        for (size_t q = 0; q <= n; ++q)
+        {
+          if (q == p || q == p + 1)
+            continue;
+
+          double leave = departure(q);
+          if (leave > job.close)
+            break;
+
+          int c = before(q);
+          double in = distance(c, u);
+          double cost = in;
+          if (q < n)
+            cost += distance(u, m_route[q]) - travel(q);
+
+          if (gain - cost <= best_gain)
+            continue;
+
+          double start = std::max(leave + in / m_speed, job.open);
+          if (start > job.close)
+            continue;
+
+          if (q < n)
+          {
+            double out = distance(u, m_route[q]);
+            if (start + job.duration + out / m_speed - m_arrive[q] > m_slack[q])
+              continue;
+          }
+
+          best = q;
+          best_gain = gain - cost;
+          found = true;
+        }
+
+        return found;
+      }
+    };
+  }
+}
+
+#endif
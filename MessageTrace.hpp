@@ -0,0 +1,449 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_MESSAGE_TRACE_HPP_INCLUDED_
+#define MANEUVER_TEST_MESSAGE_TRACE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Message trace magic number ("TRCE").
+    static const uint32_t c_trace_magic = 0x45435254;
+    //! Message trace format version.
+    static const uint16_t c_trace_version = 1;
+
+    //! Message trace file header.
+    struct TraceHeader
+    {
+      uint32_t magic;
+      uint16_t version;
+      uint16_t reserved;
+      //! Time the task started (s).
+      double start;
+    };
+
+    //! Message trace record header, followed by the serialized message.
+    struct TraceRecord
+    {
+      enum Direction
+      {
+        //! Message consumed by the task.
+        TRACE_IN = 0,
+        //! Message dispatched by the task.
+        TRACE_OUT = 1
+      };
+
+      //! Task time of the message (s).
+      double time;
+      //! Message direction.
+      uint8_t direction;
+      uint8_t reserved;
+      //! Serialized message size.
+      uint16_t size;
+      uint32_t reserved2;
+    };
+
+    //! Records messages consumed and dispatched by a task, as IMC
+    //! packets tagged with the task time.
+    class TraceWriter
+    {
+    public:
+      TraceWriter(void):
+        m_file(NULL),
+        m_count(0),
+        m_buffer(65535)
+      { }
+
+      ~TraceWriter(void)
+      {
+        close();
+      }
+
+      //! Create a trace file.
+      //! @param[in] path file path.
+      //! @param[in] start task start time (s).
+      void
+      open(const std::string& path, double start)
+      {
+        close();
+
+        m_file = std::fopen(path.c_str(), "wb");
+        if (m_file == NULL)
+          throw std::runtime_error(path + ": " + std::strerror(errno));
+
+        TraceHeader hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = c_trace_magic;
+        hdr.version = c_trace_version;
+        hdr.start = start;
+        std::fwrite(&hdr, sizeof(hdr), 1, m_file);
+        m_count = 0;
+      }
+
+      //! Append a message.
+      //! @param[in] time task time (s).
+      //! @param[in] direction message direction.
+      //! @param[in] msg message.
+      void
+      write(double time, TraceRecord::Direction direction, const IMC::Message* msg)
+      {
+        if (m_file == NULL)
+          return;
+
+        TraceRecord rec;
+        std::memset(&rec, 0, sizeof(rec));
+        rec.time = time;
+        rec.direction = direction;
+        rec.size = IMC::Packet::serialize(msg, &m_buffer[0], m_buffer.size());
+
+        std::fwrite(&rec, sizeof(rec), 1, m_file);
+        std::fwrite(&m_buffer[0], 1, rec.size, m_file);
+        ++m_count;
+      }
+
+      void
+      close(void)
+      {
+        if (m_file == NULL)
+          return;
+
+        std::fclose(m_file);
+        m_file = NULL;
+      }
+
+      bool
+      isOpen(void) const
+      {
+        return m_file != NULL;
+      }
+
+      //! Number of messages written.
+      unsigned long
+      getCount(void) const
+      {
+        return m_count;
+      }
+
+    private:
+      //! Trace file.
+      std::FILE* m_file;
+      //! Messages written.
+      unsigned long m_count;
+      //! Serialization buffer.
+      std::vector<uint8_t> m_buffer;
+    };
+
+    //! Reads a message trace sequentially.
+    class TraceReader
+    {
+    public:
+      TraceReader(void):
+        m_file(NULL),
+        m_buffer(65535)
+      {
+        std::memset(&m_header, 0, sizeof(m_header));
+      }
+
+      ~TraceReader(void)
+      {
+        close();
+      }
+
+      //! Open a trace file.
+      //! @param[in] path file path.
+      void
+      open(const std::string& path)
+      {
+        close();
+
+        m_file = std::fopen(path.c_str(), "rb");
+        if (m_file == NULL)
+          throw std::runtime_error(path + ": " + std::strerror(errno));
+
+        if (std::fread(&m_header, sizeof(m_header), 1, m_file) != 1
+            || m_header.magic != c_trace_magic || m_header.version != c_trace_version)
+        {
+          close();
+          throw std::runtime_error(path + ": not a message trace");
+        }
+      }
+
+      //! Read the next message.
+      //! @param[out] rec record header.
+      //! @return message, owned by the caller, or NULL at the end of the trace.
+      IMC::Message*
+      next(TraceRecord& rec)
+      {
+        while (m_file != NULL && std::fread(&rec, sizeof(rec), 1, m_file) == 1)
+        {
+          if (std::fread(&m_buffer[0], 1, rec.size, m_file) != rec.size)
+            break;
+
+          // Skip messages this build does not know.
+          IMC::Message* msg = IMC::Packet::deserialize(&m_buffer[0], rec.size);
+          if (msg != NULL)
+            return msg;
+        }
+
+        return NULL;
+      }
+
+      //! Trace header.
+      const TraceHeader&
+      header(void) const
+      {
+        return m_header;
+      }
+
+      void
+      close(void)
+      {
+        if (m_file == NULL)
+          return;
+
+        std::fclose(m_file);
+        m_file = NULL;
+      }
+
+    private:
+      //! Trace file.
+      std::FILE* m_file;
+      //! Trace header.
+      TraceHeader m_header;
+      //! Serialization buffer.
+      std::vector<uint8_t> m_buffer;
+    };
+
+    //! Compares messages dispatched during a replay against the
+    //! recorded ones. Repeated messages, such as periodic refreshes
+    //! of the same reference, are collapsed per message type since
+    //! their count depends on timing, and the remaining sequences are
+    //! compared in order as they arrive.
+    class TraceDiff
+    {
+    public:
+      TraceDiff(void):
+        m_matched(0),
+        m_mismatched(0),
+        m_first(-1.0)
+      { }
+
+      ~TraceDiff(void)
+      {
+        clear();
+      }
+
+      //! Compare messages of a given type.
+      //! @param[in] id IMC message identifier.
+      void
+      watch(uint16_t id)
+      {
+        m_last[id];
+      }
+
+      //! Add a recorded message.
+      //! @param[in] msg message, ownership is taken.
+      //! @param[in] time message time (s).
+      void
+      expect(IMC::Message* msg, double time)
+      {
+        add(0, msg, time);
+      }
+
+      //! Add a message dispatched by the replay.
+      //! @param[in] msg message, copied.
+      //! @param[in] time message time (s).
+      void
+      observe(const IMC::Message& msg, double time)
+      {
+        if (m_last.find(msg.getId()) != m_last.end())
+          add(1, msg.clone(), time);
+      }
+
+      //! Number of messages that matched.
+      unsigned long
+      getMatched(void) const
+      {
+        return m_matched;
+      }
+
+      //! Number of messages that differed.
+      unsigned long
+      getMismatched(void) const
+      {
+        return m_mismatched;
+      }
+
+      //! Recorded messages the replay did not produce.
+      size_t
+      getMissing(void) const
+      {
+        return m_pending[0].size();
+      }
+
+      //! Replay messages absent from the recording.
+      size_t
+      getExtra(void) const
+      {
+        return m_pending[1].size();
+      }
+
+      //! Time of the first mismatch, negative if none.
+      double
+      getFirstMismatch(void) const
+      {
+        return m_first;
+      }
+
+      //! Name of the first mismatching message type.
+      const std::string&
+      getFirstName(void) const
+      {
+        return m_first_name;
+      }
+
+    private:
+      //! Message waiting for its counterpart.
+      struct Entry
+      {
+        IMC::Message* msg;
+        double time;
+      };
+
+      //! Last recorded (0) and replayed (1) message of a type.
+      struct Last
+      {
+        IMC::Message* msg[2];
+
+        Last(void)
+        {
+          msg[0] = NULL;
+          msg[1] = NULL;
+        }
+      };
+
+      //! Unmatched recorded (0) and replayed (1) messages.
+      std::deque<Entry> m_pending[2];
+      //! Last message of each watched type per side, owned.
+      std::map<uint16_t, Last> m_last;
+      //! Messages matched.
+      unsigned long m_matched;
+      //! Messages mismatched.
+      unsigned long m_mismatched;
+      //! Time of the first mismatch.
+      double m_first;
+      //! Type of the first mismatch.
+      std::string m_first_name;
+
+      void
+      add(unsigned side, IMC::Message* msg, double time)
+      {
+        std::map<uint16_t, Last>::iterator itr = m_last.find(msg->getId());
+        if (itr == m_last.end())
+        {
+          delete msg;
+          return;
+        }
+
+        IMC::Message*& last = itr->second.msg[side];
+        if (last != NULL && *last == *msg)
+        {
+          delete msg;
+          return;
+        }
+
+        delete last;
+        last = msg->clone();
+
+        Entry e = {msg, time};
+        m_pending[side].push_back(e);
+
+        while (!m_pending[0].empty() && !m_pending[1].empty())
+        {
+          Entry a = m_pending[0].front();
+          Entry b = m_pending[1].front();
+          m_pending[0].pop_front();
+          m_pending[1].pop_front();
+
+          if (*a.msg == *b.msg)
+          {
+            ++m_matched;
+          }
+          else
+          {
+            if (m_mismatched++ == 0)
+            {
+              m_first = a.time;
+              m_first_name = a.msg->getName();
+            }
+          }
+
+          delete a.msg;
+          delete b.msg;
+        }
+      }
+
+      void
+      clear(void)
+      {
+        for (unsigned side = 0; side < 2; ++side)
+        {
+          for (size_t i = 0; i < m_pending[side].size(); ++i)
+            delete m_pending[side][i].msg;
+          m_pending[side].clear();
+        }
+
+        std::map<uint16_t, Last>::iterator itr = m_last.begin();
+        for (; itr != m_last.end(); ++itr)
+        {
+          delete itr->second.msg[0];
+          delete itr->second.msg[1];
+        }
+      }
+    };
+  }
+}
+
+#endif
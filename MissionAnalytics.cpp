@@ -0,0 +1,562 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+// Batch analysis of telemetry segments written by the task.
+//
+// Usage:
+//   MissionAnalytics [-j threads] [-t tolerance] [-c cell] <path>...
+//
+// Paths may be segment files or directories holding them. Segments
+// sharing a prefix (<prefix>_<n>.tlog) form one mission. Missions are
+// analysed in parallel, each in a single streaming pass over its
+// memory-mapped segments, and one summary line is printed per mission
+// followed by fleet-wide totals.
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+// ISO C++ 11 headers.
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+
+// POSIX headers.
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Local headers.
+#include "TelemetryLog.hpp"
+
+using namespace Maneuver::Test;
+
+//! Earth equatorial radius (m).
+static const double c_earth_radius = 6378137.0;
+//! Time after a transition during which overshoot is measured (s).
+static const double c_overshoot_window = 30.0;
+
+//! Analysis settings.
+struct Settings
+{
+  //! Arrival tolerance (m).
+  double tolerance;
+  //! Coverage grid cell size (m).
+  double cell;
+  //! Number of worker threads.
+  unsigned threads;
+};
+
+//! Aggregated mission statistics. Every field is a sum or a maximum
+//! so that missions merge into fleet totals.
+struct Stats
+{
+  unsigned long poses;
+  unsigned legs;
+  double xte_sum;
+  double xte_sq_sum;
+  double xte_max;
+  unsigned long xte_samples;
+  double time_row;
+  double time_transit;
+  double time_loiter;
+  unsigned transitions;
+  double overshoot_sum;
+  double overshoot_max;
+  unsigned long cells_planned;
+  unsigned long cells_covered;
+
+  Stats(void)
+  {
+    std::memset(this, 0, sizeof(*this));
+  }
+
+  void
+  merge(const Stats& o)
+  {
+    poses += o.poses;
+    legs += o.legs;
+    xte_sum += o.xte_sum;
+    xte_sq_sum += o.xte_sq_sum;
+    xte_max = std::max(xte_max, o.xte_max);
+    xte_samples += o.xte_samples;
+    time_row += o.time_row;
+    time_transit += o.time_transit;
+    time_loiter += o.time_loiter;
+    transitions += o.transitions;
+    overshoot_sum += o.overshoot_sum;
+    overshoot_max = std::max(overshoot_max, o.overshoot_max);
+    cells_planned += o.cells_planned;
+    cells_covered += o.cells_covered;
+  }
+};
+
+//! Mission made of one or more segment files.
+struct Mission
+{
+  std::string name;
+  std::vector<std::string> segments;
+  Stats stats;
+  bool ok;
+};
+
+//! Streaming analyser for a single mission.
+class Analyser
+{
+public:
+  Analyser(const Settings& settings, Stats& stats):
+    m_settings(settings),
+    m_stats(stats),
+    m_has_origin(false),
+    m_has_ref(false),
+    m_has_prev_ref(false),
+    m_last_pose_time(-1.0),
+    m_transition_time(-1.0),
+    m_overshoot(0.0)
+  { }
+
+  void
+  process(const TelemetryRecord& rec)
+  {
+    if (rec.type == TelemetryRecord::REC_POSE)
+      onPose(rec);
+    else if (rec.type == TelemetryRecord::REC_REFERENCE)
+      onReference(rec);
+  }
+
+  void
+  finish(void)
+  {
+    flushOvershoot();
+    m_stats.cells_planned = m_planned.size();
+
+    // A planned cell counts as covered when the track passed through
+    // it or one of its neighbours, so that a row lying on a cell
+    // boundary is not penalised.
+    for (std::unordered_set<long long>::const_iterator itr = m_planned.begin();
+         itr != m_planned.end(); ++itr)
+    {
+      long long i = *itr >> 32;
+      long long j = (int32_t)(*itr & 0xffffffffLL);
+      bool covered = false;
+
+      for (int di = -1; di <= 1 && !covered; ++di)
+      {
+        for (int dj = -1; dj <= 1 && !covered; ++dj)
+          covered = m_covered.count(pack(i + di, j + dj)) > 0;
+      }
+
+      if (covered)
+        ++m_stats.cells_covered;
+    }
+  }
+
+private:
+  //! Point in the local frame (m).
+  struct Point
+  {
+    double x;
+    double y;
+  };
+
+  const Settings& m_settings;
+  Stats& m_stats;
+  bool m_has_origin;
+  double m_lat0;
+  double m_lon0;
+  double m_cos_lat0;
+  bool m_has_ref;
+  bool m_has_prev_ref;
+  Point m_ref;
+  Point m_prev_ref;
+  Point m_pose;
+  double m_last_pose_time;
+  //! Previous leg, used for overshoot after a transition.
+  Point m_old_start;
+  Point m_old_end;
+  double m_transition_time;
+  double m_overshoot;
+  std::unordered_set<long long> m_planned;
+  std::unordered_set<long long> m_covered;
+
+  Point
+  toLocal(double lat, double lon)
+  {
+    if (!m_has_origin)
+    {
+      m_lat0 = lat;
+      m_lon0 = lon;
+      m_cos_lat0 = std::cos(lat);
+      m_has_origin = true;
+    }
+
+    Point p;
+    p.x = (lat - m_lat0) * c_earth_radius;
+    p.y = (lon - m_lon0) * c_earth_radius * m_cos_lat0;
+    return p;
+  }
+
+  static long long
+  pack(long long i, long long j)
+  {
+    return (long long)((unsigned long long)i << 32) | (j & 0xffffffffLL);
+  }
+
+  long long
+  cellKey(const Point& p) const
+  {
+    return pack((long long)std::floor(p.x / m_settings.cell),
+                (long long)std::floor(p.y / m_settings.cell));
+  }
+
+  //! Mark cells along a segment.
+  void
+  rasterise(const Point& a, const Point& b, std::unordered_set<long long>& cells)
+  {
+    double len = std::sqrt((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y));
+    unsigned steps = (unsigned)(len / (m_settings.cell * 0.5)) + 1;
+
+    for (unsigned i = 0; i <= steps; ++i)
+    {
+      double f = (double)i / steps;
+      Point p;
+      p.x = a.x + (b.x - a.x) * f;
+      p.y = a.y + (b.y - a.y) * f;
+      cells.insert(cellKey(p));
+    }
+  }
+
+  void
+  onReference(const TelemetryRecord& rec)
+  {
+    Point p = toLocal(rec.lat, rec.lon);
+
+    if (m_has_ref && p.x == m_ref.x && p.y == m_ref.y)
+      return;
+
+    if (m_has_ref)
+    {
+      if (m_has_prev_ref)
+      {
+        flushOvershoot();
+        m_old_start = m_prev_ref;
+        m_old_end = m_ref;
+        m_transition_time = rec.time;
+        m_overshoot = 0.0;
+        ++m_stats.transitions;
+      }
+
+      m_prev_ref = m_ref;
+      m_has_prev_ref = true;
+      rasterise(m_prev_ref, p, m_planned);
+      ++m_stats.legs;
+    }
+
+    m_ref = p;
+    m_has_ref = true;
+  }
+
+  void
+  onPose(const TelemetryRecord& rec)
+  {
+    Point p = toLocal(rec.lat, rec.lon);
+    ++m_stats.poses;
+
+    if (m_last_pose_time >= 0.0)
+    {
+      rasterise(m_pose, p, m_covered);
+      classify(rec.time - m_last_pose_time);
+    }
+    else
+    {
+      m_covered.insert(cellKey(p));
+    }
+
+    m_pose = p;
+    m_last_pose_time = rec.time;
+
+    if (m_has_ref && m_has_prev_ref)
+    {
+      double xte = std::fabs(crossTrack(m_prev_ref, m_ref, p));
+      m_stats.xte_sum += xte;
+      m_stats.xte_sq_sum += xte * xte;
+      m_stats.xte_max = std::max(m_stats.xte_max, xte);
+      ++m_stats.xte_samples;
+    }
+
+    if (m_transition_time >= 0.0)
+    {
+      if (rec.time - m_transition_time > c_overshoot_window)
+        flushOvershoot();
+      else
+        m_overshoot = std::max(m_overshoot, alongTrack(m_old_start, m_old_end, p));
+    }
+  }
+
+  //! Account the overshoot of the transition being measured, if any.
+  void
+  flushOvershoot(void)
+  {
+    if (m_transition_time < 0.0)
+      return;
+
+    m_stats.overshoot_sum += m_overshoot;
+    m_stats.overshoot_max = std::max(m_stats.overshoot_max, m_overshoot);
+    m_transition_time = -1.0;
+  }
+
+  //! Attribute elapsed time to loiter, row or transit.
+  void
+  classify(double dt)
+  {
+    if (!m_has_ref || dt <= 0.0)
+      return;
+
+    double dx = m_ref.x - m_pose.x;
+    double dy = m_ref.y - m_pose.y;
+    if (std::sqrt(dx * dx + dy * dy) <= m_settings.tolerance || !m_has_prev_ref)
+    {
+      m_stats.time_loiter += dt;
+      return;
+    }
+
+    // Rows run east-west, legs between rows run north-south.
+    if (std::fabs(m_ref.y - m_prev_ref.y) >= std::fabs(m_ref.x - m_prev_ref.x))
+      m_stats.time_row += dt;
+    else
+      m_stats.time_transit += dt;
+  }
+
+  //! Signed distance from a point to the line through a and b.
+  static double
+  crossTrack(const Point& a, const Point& b, const Point& p)
+  {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double len = std::sqrt(dx * dx + dy * dy);
+    if (len < 1e-6)
+      return std::sqrt((p.x - a.x) * (p.x - a.x) + (p.y - a.y) * (p.y - a.y));
+
+    return ((p.x - a.x) * dy - (p.y - a.y) * dx) / len;
+  }
+
+  //! Distance travelled past b along the direction from a to b.
+  static double
+  alongTrack(const Point& a, const Point& b, const Point& p)
+  {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double len = std::sqrt(dx * dx + dy * dy);
+    if (len < 1e-6)
+      return 0.0;
+
+    return std::max(0.0, ((p.x - b.x) * dx + (p.y - b.y) * dy) / len);
+  }
+};
+
+static bool
+analyse(Mission& mission, const Settings& settings)
+{
+  Analyser analyser(settings, mission.stats);
+
+  for (size_t i = 0; i < mission.segments.size(); ++i)
+  {
+    TelemetryReader rd;
+
+    try
+    {
+      rd.open(mission.segments[i]);
+    }
+    catch (std::exception& e)
+    {
+      std::fprintf(stderr, "%s\n", e.what());
+      return false;
+    }
+
+    for (const TelemetryRecord* r = rd.begin(); r != rd.end(); ++r)
+      analyser.process(*r);
+  }
+
+  analyser.finish();
+  return true;
+}
+
+static void
+addSegment(const std::string& path, std::map<std::string, Mission>& missions)
+{
+  static const std::string c_ext = ".tlog";
+
+  if (path.size() <= c_ext.size() + 7 || path.compare(path.size() - c_ext.size(), c_ext.size(), c_ext) != 0)
+    return;
+
+  // Strip "_<n>.tlog" to get the mission name.
+  std::string name = path.substr(0, path.size() - c_ext.size() - 7);
+  Mission& m = missions[name];
+  m.name = name;
+  m.segments.push_back(path);
+}
+
+static void
+addPath(const std::string& path, std::map<std::string, Mission>& missions)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0)
+  {
+    std::perror(path.c_str());
+    return;
+  }
+
+  if (!S_ISDIR(st.st_mode))
+  {
+    addSegment(path, missions);
+    return;
+  }
+
+  DIR* dir = ::opendir(path.c_str());
+  if (dir == NULL)
+  {
+    std::perror(path.c_str());
+    return;
+  }
+
+  struct dirent* entry;
+  while ((entry = ::readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] != '.')
+      addPath(path + "/" + entry->d_name, missions);
+  }
+
+  ::closedir(dir);
+}
+
+static void
+printStats(const char* name, const Stats& s)
+{
+  double time = s.time_row + s.time_transit + s.time_loiter;
+  double xte_mean = s.xte_samples ? s.xte_sum / s.xte_samples : 0.0;
+  double xte_rms = s.xte_samples ? std::sqrt(s.xte_sq_sum / s.xte_samples) : 0.0;
+
+  std::printf("%s: legs %u, poses %lu, xte mean %.2f m rms %.2f m max %.2f m,"
+              " row %.1f%% transit %.1f%% loiter %.1f%%,"
+              " overshoot mean %.2f m max %.2f m, coverage %.1f%%\n",
+              name, s.legs, s.poses, xte_mean, xte_rms, s.xte_max,
+              time > 0 ? 100.0 * s.time_row / time : 0.0,
+              time > 0 ? 100.0 * s.time_transit / time : 0.0,
+              time > 0 ? 100.0 * s.time_loiter / time : 0.0,
+              s.transitions ? s.overshoot_sum / s.transitions : 0.0, s.overshoot_max,
+              s.cells_planned ? 100.0 * s.cells_covered / s.cells_planned : 0.0);
+}
+
+int
+main(int argc, char** argv)
+{
+  Settings settings;
+  settings.tolerance = 15.0;
+  settings.cell = 5.0;
+  settings.threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::map<std::string, Mission> by_name;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+
+    if ((arg == "-j" || arg == "-t" || arg == "-c") && i + 1 < argc)
+    {
+      double value = std::atof(argv[++i]);
+      if (arg == "-j")
+        settings.threads = std::max(1, (int)value);
+      else if (arg == "-t")
+        settings.tolerance = value;
+      else
+        settings.cell = value > 0.0 ? value : settings.cell;
+      continue;
+    }
+
+    addPath(arg, by_name);
+  }
+
+  if (by_name.empty())
+  {
+    std::fprintf(stderr, "Usage: %s [-j threads] [-t tolerance] [-c cell] <path>...\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<Mission> missions;
+  for (std::map<std::string, Mission>::iterator itr = by_name.begin(); itr != by_name.end(); ++itr)
+  {
+    std::sort(itr->second.segments.begin(), itr->second.segments.end());
+    missions.push_back(itr->second);
+  }
+
+  // Workers pick the next unprocessed mission until none are left.
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  unsigned count = std::min<size_t>(settings.threads, missions.size());
+
+  for (unsigned i = 0; i < count; ++i)
+  {
+    workers.push_back(std::thread([&]()
+    {
+      size_t index;
+      while ((index = next.fetch_add(1)) < missions.size())
+        missions[index].ok = analyse(missions[index], settings);
+    }));
+  }
+
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+
+  Stats fleet;
+  unsigned failed = 0;
+
+  for (size_t i = 0; i < missions.size(); ++i)
+  {
+    if (!missions[i].ok)
+    {
+      ++failed;
+      continue;
+    }
+
+    printStats(missions[i].name.c_str(), missions[i].stats);
+    fleet.merge(missions[i].stats);
+  }
+
+  char label[64];
+  std::snprintf(label, sizeof(label), "fleet (%u missions)", (unsigned)(missions.size() - failed));
+  printStats(label, fleet);
+
+  return failed ? 1 : 0;
+}
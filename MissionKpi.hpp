@@ -0,0 +1,298 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_MISSION_KPI_HPP_INCLUDED_
+#define MANEUVER_TEST_MISSION_KPI_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "Route.hpp"
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Ground speed under which the vehicle is considered loitering (m/s).
+    static const double c_kpi_loiter_speed = 0.2;
+    //! Time constant of the water current estimate (s).
+    static const double c_kpi_current_tau = 60.0;
+
+    //! Snapshot of mission key performance indicators.
+    struct KpiSnapshot
+    {
+      //! Time since route start (s).
+      double elapsed;
+      //! Surveyed area (m^2).
+      double area;
+      //! Surveyed area rate (m^2/h).
+      double area_rate;
+      //! Time on survey rows (s).
+      double row_time;
+      //! Time on transit legs (s).
+      double transit_time;
+      //! Time loitering (s).
+      double loiter_time;
+      //! Remaining path length (m).
+      double remaining;
+      //! Estimated time to completion (s), negative if unknown.
+      double eta;
+      //! Estimated water current, north (m/s).
+      double current_x;
+      //! Estimated water current, east (m/s).
+      double current_y;
+      //! Predicted fuel left after completion and return (%).
+      double energy_margin;
+      //! True if the energy margin is known.
+      bool has_energy;
+      //! True when following a leader in formation.
+      bool formation;
+      //! Root mean square formation spacing error (m).
+      double spacing_rms;
+      //! Largest formation spacing error (m).
+      double spacing_max;
+      //! Active waypoint.
+      uint32_t index;
+    };
+
+    //! Incremental mission KPIs. Per-leg sums are accumulated from the
+    //! end of the route once when it is set, so every navigation
+    //! sample is processed in constant time. The ETA accounts for the
+    //! estimated current with a second order expansion of the leg
+    //! times, whose route dependent terms are those suffix sums.
+    class MissionKpi
+    {
+    public:
+      MissionKpi(void):
+        m_swath(0.0)
+      {
+        clear();
+      }
+
+      //! Start tracking a route.
+      //! @param[in] route route, with the vehicle at its origin.
+      //! @param[in] swath width covered along survey rows (m).
+      void
+      reset(const Route& route, double swath)
+      {
+        m_swath = swath;
+        clear();
+        setRoute(route);
+      }
+
+      //! Replace the route, keeping the indicators gathered so far.
+      //! @param[in] route route, with the vehicle at its origin.
+      void
+      setRoute(const Route& route)
+      {
+        size_t n = route.size();
+        m_x.resize(n);
+        m_y.resize(n);
+        m_len.assign(n + 1, 0.0);
+        m_mxx.assign(n + 1, 0.0);
+        m_mxy.assign(n + 1, 0.0);
+        m_myy.assign(n + 1, 0.0);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+          m_x[i] = route[i].x;
+          m_y[i] = route[i].y;
+        }
+
+        // Entry i sums legs i..n-1, leg i ending at waypoint i.
+        for (size_t i = n; i-- > 0; )
+        {
+          double px = i > 0 ? m_x[i - 1] : 0.0;
+          double py = i > 0 ? m_y[i - 1] : 0.0;
+          double dx = m_x[i] - px;
+          double dy = m_y[i] - py;
+          double len = std::sqrt(dx * dx + dy * dy);
+          double ux = len > 0.0 ? dx / len : 0.0;
+          double uy = len > 0.0 ? dy / len : 0.0;
+
+          m_len[i] = m_len[i + 1] + len;
+          m_mxx[i] = m_mxx[i + 1] + len * ux * ux;
+          m_mxy[i] = m_mxy[i + 1] + len * ux * uy;
+          m_myy[i] = m_myy[i + 1] + len * uy * uy;
+        }
+      }
+
+      //! Process a navigation sample.
+      //! @param[in] time sample time (s).
+      //! @param[in] x vehicle north position in the route frame (m).
+      //! @param[in] y vehicle east position in the route frame (m).
+      //! @param[in] vx ground velocity north (m/s).
+      //! @param[in] vy ground velocity east (m/s).
+      //! @param[in] u speed through water (m/s).
+      //! @param[in] psi heading (rad).
+      //! @param[in] index active waypoint.
+      //! @param[in] survey true if the active leg is a survey row.
+      //! @param[in] speed commanded speed (m/s).
+      //! @param[in] arrived true if within tolerance of the active waypoint.
+      void
+      update(double time, double x, double y, double vx, double vy, double u,
+             double psi, size_t index, bool survey, double speed, bool arrived)
+      {
+        if (m_x.empty() || index >= m_x.size())
+          return;
+
+        if (m_start < 0.0)
+        {
+          m_start = time;
+          m_last_time = time;
+          m_last_x = x;
+          m_last_y = y;
+        }
+
+        double dt = time - m_last_time;
+        double gs = std::sqrt(vx * vx + vy * vy);
+
+        if (dt > 0.0)
+        {
+          double ds = std::sqrt((x - m_last_x) * (x - m_last_x) + (y - m_last_y) * (y - m_last_y));
+
+          if (arrived || gs < c_kpi_loiter_speed)
+          {
+            m_kpi.loiter_time += dt;
+          }
+          else if (survey)
+          {
+            m_kpi.row_time += dt;
+            m_kpi.area += ds * m_swath;
+          }
+          else
+          {
+            m_kpi.transit_time += dt;
+          }
+
+          // Current is ground velocity minus velocity through water.
+          double a = dt / (c_kpi_current_tau + dt);
+          m_kpi.current_x += a * ((vx - u * std::cos(psi)) - m_kpi.current_x);
+          m_kpi.current_y += a * ((vy - u * std::sin(psi)) - m_kpi.current_y);
+        }
+
+        m_last_time = time;
+        m_last_x = x;
+        m_last_y = y;
+
+        m_kpi.index = index;
+        m_kpi.elapsed = time - m_start;
+        m_kpi.area_rate = m_kpi.elapsed > 0.0 ? m_kpi.area * 3600.0 / m_kpi.elapsed : 0.0;
+
+        // Partial leg to the active waypoint.
+        double dx = m_x[index] - x;
+        double dy = m_y[index] - y;
+        double dist = std::sqrt(dx * dx + dy * dy);
+        m_kpi.remaining = dist + m_len[index + 1];
+
+        if (speed <= 0.0)
+        {
+          m_kpi.eta = -1.0;
+          return;
+        }
+
+        double cx = m_kpi.current_x;
+        double cy = m_kpi.current_y;
+        double eta = 0.0;
+
+        if (dist > 0.0)
+        {
+          double v = speed + (cx * dx + cy * dy) / dist;
+          eta = v > c_kpi_loiter_speed ? dist / v : dist / speed;
+        }
+
+        // Sum of len / (v + c.d) over the remaining legs, expanded as
+        // len / v * (1 - c.d / v + (c.d / v)^2).
+        size_t last = m_x.size() - 1;
+        double disp_x = m_x[last] - m_x[index];
+        double disp_y = m_y[last] - m_y[index];
+        double quad = cx * cx * m_mxx[index + 1] + 2.0 * cx * cy * m_mxy[index + 1]
+        + cy * cy * m_myy[index + 1];
+
+        eta += m_len[index + 1] / speed
+        - (cx * disp_x + cy * disp_y) / (speed * speed)
+        + quad / (speed * speed * speed);
+
+        m_kpi.eta = eta;
+      }
+
+      //! Latest indicators.
+      const KpiSnapshot&
+      get(void) const
+      {
+        return m_kpi;
+      }
+
+    private:
+      //! Swath width (m).
+      double m_swath;
+      //! Waypoint north positions (m).
+      std::vector<double> m_x;
+      //! Waypoint east positions (m).
+      std::vector<double> m_y;
+      //! Suffix sums of leg length.
+      std::vector<double> m_len;
+      //! Suffix sums of len * ux * ux.
+      std::vector<double> m_mxx;
+      //! Suffix sums of len * ux * uy.
+      std::vector<double> m_mxy;
+      //! Suffix sums of len * uy * uy.
+      std::vector<double> m_myy;
+      //! Route start time, negative before the first sample.
+      double m_start;
+      //! Previous sample time.
+      double m_last_time;
+      //! Previous north position.
+      double m_last_x;
+      //! Previous east position.
+      double m_last_y;
+      //! Current indicators.
+      KpiSnapshot m_kpi;
+
+      void
+      clear(void)
+      {
+        m_start = -1.0;
+        m_last_time = 0.0;
+        m_last_x = 0.0;
+        m_last_y = 0.0;
+        std::memset(&m_kpi, 0, sizeof(m_kpi));
+        m_kpi.eta = -1.0;
+      }
+    };
+  }
+}
+
+#endif
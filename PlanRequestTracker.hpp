@@ -0,0 +1,363 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_PLAN_REQUEST_TRACKER_HPP_INCLUDED_
+#define MANEUVER_TEST_PLAN_REQUEST_TRACKER_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Keeps track of PlanControl requests that are waiting for a
+    //! reply from the plan supervisor. Every request gets a unique
+    //! request id and lives in a small open-addressing table until it
+    //! is answered, confirmed by PlanControlState or gives up after
+    //! the configured number of attempts. Several requests may be in
+    //! flight at the same time.
+    class PlanRequestTracker
+    {
+    public:
+      //! Result of feeding a reply to the tracker.
+      enum Outcome
+      {
+        //! Reply does not belong to any pending request.
+        OUTCOME_UNKNOWN,
+        //! Request is still being processed.
+        OUTCOME_IN_PROGRESS,
+        //! Request was completed successfully.
+        OUTCOME_SUCCESS,
+        //! Request was refused or failed.
+        OUTCOME_FAILURE
+      };
+
+      //! Constructor.
+      //! @param[in] capacity maximum number of requests in flight.
+      PlanRequestTracker(unsigned capacity = 16):
+        m_count(0),
+        m_next_id(1),
+        m_timeout(2.0),
+        m_backoff(2.0),
+        m_max_attempts(3)
+      {
+        unsigned size = 4;
+        // Keep load factor under 75% to have short probe sequences.
+        while (size * 3 < capacity * 4)
+          size <<= 1;
+
+        m_slots.resize(size);
+      }
+
+      //! Set retry policy.
+      //! @param[in] timeout time to wait for the first reply.
+      //! @param[in] backoff multiplier applied to timeout on each retry.
+      //! @param[in] max_attempts maximum number of transmissions.
+      void
+      setRetryPolicy(double timeout, double backoff, unsigned max_attempts)
+      {
+        m_timeout = timeout;
+        m_backoff = backoff < 1.0 ? 1.0 : backoff;
+        m_max_attempts = max_attempts < 1 ? 1 : max_attempts;
+      }
+
+      //! Register a new request. The request id of the given message
+      //! is replaced by a unique one.
+      //! @param[in] pc plan control request.
+      //! @param[in] now current time.
+      //! @return message to dispatch or NULL if the table is full.
+      IMC::PlanControl*
+      submit(const IMC::PlanControl& pc, double now)
+      {
+        if ((m_count + 1) * 4 > m_slots.size() * 3)
+          return NULL;
+
+        uint16_t id = allocateId();
+        Slot& slot = m_slots[probe(id)];
+        slot.used = true;
+        slot.msg = pc;
+        slot.msg.request_id = id;
+        slot.attempts = 1;
+        slot.deadline = now + m_timeout;
+        ++m_count;
+
+        return &slot.msg;
+      }
+
+      //! Match a PlanControl reply against pending requests.
+      //! @param[in] reply plan control reply.
+      //! @param[in] now current time.
+      //! @param[out] request copy of the original request, if matched.
+      //! @return reply outcome.
+      Outcome
+      onReply(const IMC::PlanControl& reply, double now, IMC::PlanControl* request = NULL)
+      {
+        if (reply.type == IMC::PlanControl::PC_REQUEST)
+          return OUTCOME_UNKNOWN;
+
+        unsigned index = probe(reply.request_id);
+        Slot& slot = m_slots[index];
+        if (!slot.used || slot.msg.op != reply.op)
+          return OUTCOME_UNKNOWN;
+
+        if (reply.type == IMC::PlanControl::PC_IN_PROGRESS)
+        {
+          slot.deadline = now + m_timeout;
+          return OUTCOME_IN_PROGRESS;
+        }
+
+        if (request != NULL)
+          *request = slot.msg;
+
+        remove(index);
+
+        if (reply.type == IMC::PlanControl::PC_SUCCESS)
+          return OUTCOME_SUCCESS;
+
+        return OUTCOME_FAILURE;
+      }
+
+      //! Use plan supervisor state to settle requests whose replies
+      //! may have been lost.
+      //! @param[in] pcs plan control state.
+      //! @return number of requests considered done.
+      unsigned
+      onState(const IMC::PlanControlState& pcs)
+      {
+        bool executing = pcs.state == IMC::PlanControlState::PCS_EXECUTING;
+        unsigned settled = 0;
+
+        for (unsigned i = 0; i < m_slots.size(); )
+        {
+          Slot& slot = m_slots[i];
+          bool done = false;
+
+          if (slot.used && slot.msg.plan_id == pcs.plan_id)
+          {
+            if (slot.msg.op == IMC::PlanControl::PC_START && executing)
+              done = true;
+          }
+
+          if (slot.used && slot.msg.op == IMC::PlanControl::PC_STOP && !executing)
+            done = true;
+
+          if (done)
+          {
+            remove(i);
+            ++settled;
+            // Backward shift may have moved another entry into this slot.
+            continue;
+          }
+
+          ++i;
+        }
+
+        return settled;
+      }
+
+      //! Collect requests whose reply is overdue.
+      //! @param[in] now current time.
+      //! @param[out] resend requests that must be transmitted again.
+      //! @param[out] expired requests that ran out of attempts.
+      void
+      poll(double now, std::vector<IMC::PlanControl>& resend,
+           std::vector<IMC::PlanControl>& expired)
+      {
+        resend.clear();
+        expired.clear();
+
+        for (unsigned i = 0; i < m_slots.size(); )
+        {
+          Slot& slot = m_slots[i];
+          if (!slot.used || now < slot.deadline)
+          {
+            ++i;
+            continue;
+          }
+
+          if (slot.attempts >= m_max_attempts)
+          {
+            expired.push_back(slot.msg);
+            remove(i);
+            continue;
+          }
+
+          double wait = m_timeout;
+          for (unsigned n = 0; n < slot.attempts; ++n)
+            wait *= m_backoff;
+
+          ++slot.attempts;
+          slot.deadline = now + wait;
+          resend.push_back(slot.msg);
+          ++i;
+        }
+      }
+
+      //! Check if a request is pending.
+      //! @param[in] op plan control operation.
+      //! @param[in] plan_id plan identifier.
+      //! @return true if an identical operation is waiting for a reply.
+      bool
+      isPending(uint8_t op, const std::string& plan_id) const
+      {
+        for (unsigned i = 0; i < m_slots.size(); ++i)
+        {
+          if (m_slots[i].used && m_slots[i].msg.op == op && m_slots[i].msg.plan_id == plan_id)
+            return true;
+        }
+
+        return false;
+      }
+
+      //! Get number of requests in flight.
+      //! @return number of pending requests.
+      unsigned
+      size(void) const
+      {
+        return m_count;
+      }
+
+      //! Forget all pending requests.
+      void
+      clear(void)
+      {
+        for (unsigned i = 0; i < m_slots.size(); ++i)
+          m_slots[i].used = false;
+
+        m_count = 0;
+      }
+
+    private:
+      //! Table entry.
+      struct Slot
+      {
+        //! True if the slot holds a request.
+        bool used;
+        //! Number of transmissions so far.
+        unsigned attempts;
+        //! Time at which the request is considered lost.
+        double deadline;
+        //! Request as dispatched.
+        IMC::PlanControl msg;
+
+        Slot(void):
+          used(false),
+          attempts(0),
+          deadline(0.0)
+        { }
+      };
+
+      //! Table slots, size is a power of two.
+      std::vector<Slot> m_slots;
+      //! Number of used slots.
+      unsigned m_count;
+      //! Next request id candidate.
+      uint16_t m_next_id;
+      //! Reply timeout.
+      double m_timeout;
+      //! Timeout multiplier per retry.
+      double m_backoff;
+      //! Maximum number of transmissions.
+      unsigned m_max_attempts;
+
+      //! Home slot of a request id.
+      unsigned
+      home(uint16_t id) const
+      {
+        // Fibonacci hashing spreads consecutive ids.
+        return ((uint32_t)id * 2654435769u) >> 16 & (m_slots.size() - 1);
+      }
+
+      //! Find the slot holding an id, or the free slot where it would go.
+      unsigned
+      probe(uint16_t id) const
+      {
+        unsigned mask = m_slots.size() - 1;
+        unsigned i = home(id);
+
+        while (m_slots[i].used && m_slots[i].msg.request_id != id)
+          i = (i + 1) & mask;
+
+        return i;
+      }
+
+      //! Pick a request id not used by any pending request.
+      uint16_t
+      allocateId(void)
+      {
+        while (true)
+        {
+          uint16_t id = m_next_id++;
+          if (m_next_id == 0)
+            m_next_id = 1;
+
+          if (!m_slots[probe(id)].used)
+            return id;
+        }
+      }
+
+      //! Remove entry using backward shift deletion so that lookups
+      //! never need tombstones.
+      //! @param[in] index slot to clear.
+      void
+      remove(unsigned index)
+      {
+        unsigned mask = m_slots.size() - 1;
+        unsigned hole = index;
+        unsigned i = (index + 1) & mask;
+
+        while (m_slots[i].used)
+        {
+          unsigned h = home(m_slots[i].msg.request_id);
+          // Move entry if its home is not cyclically in (hole, i].
+          bool movable = (i > hole) ? (h <= hole || h > i) : (h <= hole && h > i);
+          if (movable)
+          {
+            m_slots[hole] = m_slots[i];
+            hole = i;
+          }
+
+          i = (i + 1) & mask;
+        }
+
+        m_slots[hole].used = false;
+        --m_count;
+      }
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,1306 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_PLANNER_WORKER_HPP_INCLUDED_
+#define MANEUVER_TEST_PLANNER_WORKER_HPP_INCLUDED_
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "CollisionAvoidance.hpp"
+#include "AdaptiveSurvey.hpp"
+#include "DepthGrid.hpp"
+#include "DoubleBuffer.hpp"
+#include "EnduranceModel.hpp"
+#include "Formation.hpp"
+#include "MissionKpi.hpp"
+#include "Geofence.hpp"
+#include "ReferenceQueue.hpp"
+#include "Route.hpp"
+#include "RouteIndex.hpp"
+#include "SpscRing.hpp"
+#include "YoyoProfile.hpp"
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Time the worker sleeps when it has nothing to do (s).
+    static const double c_planner_idle = 0.005;
+    //! Fastest contact speed considered when searching for threats (m/s).
+    static const double c_max_contact_speed = 10.0;
+    //! Minimum period between avoidance target updates (s).
+    static const double c_avoid_period = 1.0;
+    //! Heading change that forces an avoidance target update (rad).
+    static const double c_avoid_heading_change = 0.17;
+    //! Fraction of a row over mapped cells for it to be skipped.
+    static const double c_depth_known_coverage = 0.9;
+    //! Distance off a survey leg, in horizontal tolerances, that
+    //! sends the vehicle back to where coverage stopped.
+    static const double c_rejoin_drift = 3.0;
+    //! Distance under which a rejoin point snaps to a waypoint (m).
+    static const double c_rejoin_snap = 1.0;
+    //! Minimum period between formation setpoints (s).
+    static const double c_formation_period = 1.0;
+    //! Speed change per metre of along track slot error (1/s).
+    static const double c_formation_gain = 0.1;
+    //! Fastest formation speed, relative to the faster of the leader
+    //! and the nominal speed.
+    static const double c_formation_max_speed = 1.5;
+
+    //! Vehicle pose at a given time.
+    struct PoseSample
+    {
+      //! Time of the sample (s).
+      double time;
+      //! Latitude (rad).
+      double lat;
+      //! Longitude (rad).
+      double lon;
+      //! Depth (m).
+      float depth;
+      //! Heading (rad).
+      float psi;
+      //! Speed over ground (m/s).
+      float speed;
+      //! Ground velocity north (m/s).
+      float vx;
+      //! Ground velocity east (m/s).
+      float vy;
+      //! Speed through water (m/s).
+      float u;
+      //! Altitude above the seabed, negative if unknown (m).
+      float alt;
+      //! Turn rate (rad/s).
+      float r;
+    };
+
+    //! Message from the consumer thread to the planner.
+    struct PlannerEvent
+    {
+      enum Type
+      {
+        //! New navigation sample.
+        EV_POSE,
+        //! FollowRefState report.
+        EV_FOLLOW_REF,
+        //! Contact fix.
+        EV_CONTACT,
+        //! Fuel level report.
+        EV_FUEL,
+        //! Sensor detection.
+        EV_DETECTION,
+        //! Route settings changed.
+        EV_PARAMS,
+        //! Plan resumed after an interruption.
+        EV_REJOIN,
+        //! Formation leader pose.
+        EV_LEADER
+      };
+
+      //! Event type.
+      uint8_t type;
+      //! Pose, for EV_POSE and EV_LEADER, or contact fix, for EV_CONTACT.
+      PoseSample pose;
+      //! Contact identifier, for EV_CONTACT.
+      uint32_t contact;
+      //! Reported reference latitude, for EV_FOLLOW_REF (rad).
+      double ref_lat;
+      //! Reported reference longitude, for EV_FOLLOW_REF (rad).
+      double ref_lon;
+      //! Reported proximity flags, for EV_FOLLOW_REF.
+      uint8_t proximity;
+      //! True if the report carried a reference.
+      bool has_ref;
+      //! Fuel level, for EV_FUEL (%).
+      float fuel;
+      //! Detection score, for EV_DETECTION.
+      float score;
+      //! Number of rows, for EV_PARAMS.
+      unsigned rows;
+      //! Row length, for EV_PARAMS (m).
+      float h;
+      //! Row spacing, for EV_PARAMS (m).
+      float s;
+      //! Vertical reference, for EV_PARAMS (m).
+      float z;
+      //! Speed, for EV_PARAMS (m/s).
+      float speed;
+      //! True if the route geometry changed, for EV_PARAMS.
+      bool geometry;
+    };
+
+    //! Planner settings, copied into the worker before it starts.
+    struct PlannerConfig
+    {
+      unsigned rows;
+      double h;
+      double s;
+      double z;
+      double speed;
+      double horizontal_tolerance;
+      unsigned lookahead;
+      //! Operating area, must outlive the worker.
+      const Geofence* fence;
+      //! Move violating waypoints inside instead of dropping them.
+      bool fence_clamp;
+      //! Distance kept from geofence boundaries when clamping (m).
+      double fence_margin;
+      //! Steer clear of contacts.
+      bool avoidance;
+      //! Minimum passing distance to contacts (m).
+      double safety_radius;
+      //! Collision prediction horizon (s).
+      double avoidance_horizon;
+      //! Time after which a silent contact is forgotten (s).
+      double contact_timeout;
+      //! Return to base when the predicted energy margin runs low.
+      bool endurance;
+      //! Fuel left on arrival back at base (%).
+      double energy_reserve;
+      //! Insert fine sub-patterns over detection hotspots.
+      bool adaptive;
+      //! Cell score at which a hotspot is refined.
+      double hotspot_score;
+      //! Ratio between coarse and fine row spacing.
+      unsigned refinement;
+      //! Maximum number of refined cells.
+      unsigned max_refinements;
+      //! Seabed depth map, updated and used by the worker only, may be NULL.
+      DepthGrid* depth;
+      //! True if z references are depths.
+      bool z_depth;
+      //! Legs crossing shallower water are skipped (m).
+      double min_depth;
+      //! Distance kept above the seabed by depth references (m).
+      double clearance;
+      //! Drop survey rows over already mapped seabed.
+      bool skip_known;
+      //! Follow a vertical sawtooth along the legs.
+      bool profiling;
+      //! Shallowest profile z (m).
+      double profile_min_z;
+      //! Deepest profile z (m).
+      double profile_max_z;
+      //! Profile flight path angle (rad).
+      double profile_pitch;
+      //! Z change between profile waypoints (m).
+      double profile_step;
+      //! Z distance to a profile waypoint counted as arrival (m).
+      double vertical_tolerance;
+      //! Track route coverage and rejoin where it stopped after a deviation.
+      bool rejoin;
+      //! Follow a leader instead of the route.
+      bool formation;
+      //! Job plans are run instead of the route.
+      bool scheduling;
+      //! Slot offset ahead of the leader (m).
+      double formation_forward;
+      //! Slot offset to the right of the leader (m).
+      double formation_starboard;
+      //! Time ahead of the slot the reference is placed (s).
+      double formation_lead;
+      //! Longest leader prediction before it is considered lost (s).
+      double formation_timeout;
+    };
+
+    //! Runs route generation and waypoint sequencing away from the
+    //! task's consume thread. Input arrives through a lock-free ring
+    //! and new setpoints are published through a double buffer that
+    //! the task polls from onMain().
+    class PlannerWorker: public Concurrency::Thread
+    {
+    public:
+      //! Constructor.
+      //! @param[in] cfg planner settings.
+      //! @param[in] capacity event ring capacity.
+      PlannerWorker(const PlannerConfig& cfg, unsigned capacity = 256):
+        m_cfg(cfg),
+        m_events(capacity),
+        m_queue(cfg.lookahead + 1),
+        m_next_wp(0),
+        m_active(false),
+        m_has_pose(false),
+        m_arrival(-1.0),
+        m_dropped(0),
+        m_fence_clamped(0),
+        m_fence_rejected(0),
+        m_vo(cfg.safety_radius, cfg.avoidance_horizon),
+        m_avoiding(false),
+        m_avoid_time(0.0),
+        m_avoid_heading(0.0),
+        m_returning(false),
+        m_refinements(0),
+        m_shallow(0),
+        m_skipped(0),
+        m_leg_next(0),
+        m_leg_index(0),
+        m_leg_floor(0.0),
+        m_frontier(0.0),
+        m_rejoining(false),
+        m_formation_time(-1.0),
+        m_leader_lost(false)
+      {
+        m_current.partial = false;
+        m_formation.setup(cfg.formation_forward, cfg.formation_starboard, cfg.formation_timeout);
+      }
+
+      //! Queue an event. Consumer thread only.
+      //! @param[in] ev event.
+      //! @return false if the event was dropped.
+      bool
+      post(const PlannerEvent& ev)
+      {
+        if (m_events.push(ev))
+          return true;
+
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      //! Process all queued events in the calling thread, for replays
+      //! where the worker thread is not started.
+      void
+      drain(void)
+      {
+        PlannerEvent ev;
+        while (m_events.pop(ev))
+          process(ev);
+      }
+
+      //! Fetch the latest setpoint if a new one was published.
+      //! @param[in,out] seq sequence number of the last setpoint read.
+      //! @param[out] sp setpoint.
+      //! @return true if a new setpoint was read.
+      bool
+      poll(unsigned& seq, Setpoint& sp) const
+      {
+        return m_setpoint.read(seq, sp);
+      }
+
+      //! Number of events dropped because the ring was full.
+      unsigned
+      getDropped(void) const
+      {
+        return m_dropped.load(std::memory_order_relaxed);
+      }
+
+      //! Fetch the latest mission indicators if they changed.
+      //! @param[in,out] seq sequence number of the last snapshot read.
+      //! @param[out] kpi indicators.
+      //! @return true if a new snapshot was read.
+      bool
+      pollKpi(unsigned& seq, KpiSnapshot& kpi) const
+      {
+        return m_kpi_out.read(seq, kpi);
+      }
+
+      //! Number of hotspot cells refined so far.
+      unsigned
+      getRefinements(void) const
+      {
+        return m_refinements.load(std::memory_order_relaxed);
+      }
+
+      //! Number of waypoints dropped because of shallow water.
+      unsigned
+      getShallow(void) const
+      {
+        return m_shallow.load(std::memory_order_relaxed);
+      }
+
+      //! Number of survey rows dropped over mapped seabed.
+      unsigned
+      getSkipped(void) const
+      {
+        return m_skipped.load(std::memory_order_relaxed);
+      }
+
+      //! Check if the formation leader was lost.
+      bool
+      isLeaderLost(void) const
+      {
+        return m_leader_lost.load(std::memory_order_relaxed);
+      }
+
+      //! Number of waypoints moved inside the geofence.
+      unsigned
+      getFenceClamped(void) const
+      {
+        return m_fence_clamped.load(std::memory_order_relaxed);
+      }
+
+      //! Number of waypoints dropped by the geofence.
+      unsigned
+      getFenceRejected(void) const
+      {
+        return m_fence_rejected.load(std::memory_order_relaxed);
+      }
+
+    private:
+      //! Planner settings.
+      PlannerConfig m_cfg;
+      //! Input events.
+      SpscRing<PlannerEvent> m_events;
+      //! Latest setpoint.
+      DoubleBuffer<Setpoint> m_setpoint;
+      //! Mission indicators.
+      MissionKpi m_kpi;
+      //! Latest mission indicators.
+      DoubleBuffer<KpiSnapshot> m_kpi_out;
+      //! Survey route.
+      Route m_route;
+      //! Setpoints prepared for the upcoming waypoints.
+      ReferenceQueue m_queue;
+      //! Next route waypoint to be queued.
+      size_t m_next_wp;
+      //! Active setpoint.
+      Setpoint m_current;
+      //! True while following the route.
+      bool m_active;
+      //! True once a pose was received.
+      bool m_has_pose;
+      //! Last pose.
+      PoseSample m_pose;
+      //! Time of arrival at the active setpoint.
+      double m_arrival;
+      //! Number of dropped events.
+      std::atomic<unsigned> m_dropped;
+      //! Latitude of the last queued setpoint (rad).
+      double m_last_lat;
+      //! Longitude of the last queued setpoint (rad).
+      double m_last_lon;
+      //! Number of waypoints moved inside the geofence.
+      std::atomic<unsigned> m_fence_clamped;
+      //! Number of waypoints dropped by the geofence.
+      std::atomic<unsigned> m_fence_rejected;
+      //! Known contacts.
+      ContactTracker m_contacts;
+      //! Avoidance velocity selection.
+      VelocityObstacle m_vo;
+      //! Contacts near the vehicle, reused across poses.
+      std::vector<const Contact*> m_nearby;
+      //! True while steering clear of a contact.
+      bool m_avoiding;
+      //! Time the last avoidance target was published.
+      double m_avoid_time;
+      //! Heading of the last avoidance target (rad).
+      double m_avoid_heading;
+      //! Energy consumption model.
+      EnduranceModel m_energy;
+      //! True once the route was cut short to return to base.
+      bool m_returning;
+      //! Detection scores over the coarse grid.
+      HotspotGrid m_hotspots;
+      //! Sub-pattern waypoints, reused across refinements.
+      std::vector<Waypoint> m_patterns;
+      //! Number of hotspot cells refined.
+      std::atomic<unsigned> m_refinements;
+      //! Number of waypoints dropped because of shallow water.
+      std::atomic<unsigned> m_shallow;
+      //! Number of survey rows dropped over mapped seabed.
+      std::atomic<unsigned> m_skipped;
+      //! Vertical profile generator.
+      YoyoProfile m_profile;
+      //! Profile waypoints of the leg being queued.
+      std::vector<Waypoint> m_leg;
+      //! Next leg waypoint to be queued.
+      size_t m_leg_next;
+      //! Route waypoint the leg ends at.
+      size_t m_leg_index;
+      //! Deepest z allowed along the leg (m).
+      double m_leg_floor;
+      //! Route segments, for rejoining.
+      RouteIndex m_index;
+      //! Distance along the route covered without a gap (m).
+      double m_frontier;
+      //! True while heading back to the coverage frontier.
+      bool m_rejoining;
+      //! Formation slot tracking.
+      FormationTracker m_formation;
+      //! Time the last formation setpoint was published.
+      double m_formation_time;
+      //! True while the leader is not heard.
+      std::atomic<bool> m_leader_lost;
+
+      void
+      run(void)
+      {
+        PlannerEvent ev;
+
+        while (!isStopping())
+        {
+          if (!m_events.pop(ev))
+          {
+            Delay::wait(c_planner_idle);
+            continue;
+          }
+
+          process(ev);
+        }
+      }
+
+      void
+      process(const PlannerEvent& ev)
+      {
+        if (ev.type == PlannerEvent::EV_POSE)
+          onPose(ev.pose);
+        else if (ev.type == PlannerEvent::EV_FOLLOW_REF)
+          onFollowRef(ev);
+        else if (ev.type == PlannerEvent::EV_CONTACT)
+          onContact(ev);
+        else if (ev.type == PlannerEvent::EV_FUEL)
+          m_energy.update(ev.pose.time, ev.fuel);
+        else if (ev.type == PlannerEvent::EV_DETECTION)
+          onDetection(ev);
+        else if (ev.type == PlannerEvent::EV_PARAMS)
+          onParams(ev);
+        else if (ev.type == PlannerEvent::EV_REJOIN)
+          onRejoin();
+        else if (ev.type == PlannerEvent::EV_LEADER)
+          onLeader(ev.pose);
+      }
+
+      void
+      onPose(const PoseSample& pose)
+      {
+        m_pose = pose;
+        m_has_pose = true;
+        m_energy.integrate(pose.time, pose.u);
+
+        if (m_cfg.depth != NULL && pose.alt >= 0.0)
+          m_cfg.depth->update(pose.lat, pose.lon, pose.depth + pose.alt);
+
+        if (m_cfg.formation)
+        {
+          follow(pose);
+          return;
+        }
+
+        if (!m_active)
+          return;
+
+        double x, y;
+        m_route.toLocal(pose.lat, pose.lon, &x, &y);
+
+        double dist = WGS84::distance(pose.lat, pose.lon, 0.0,
+                                      m_current.lat, m_current.lon, 0.0);
+        bool arrived = dist <= m_cfg.horizontal_tolerance && isLevel(pose);
+        // Arrival is checked against the new setpoints on the next pose.
+        if (updateKpi(pose, x, y, arrived))
+          return;
+
+        if (m_cfg.rejoin && track(x, y))
+          return;
+
+        if (arrived)
+        {
+          if (m_arrival < 0.0)
+            m_arrival = pose.time;
+
+          if (m_cfg.lookahead > 0)
+          {
+            next();
+            m_rejoining = false;
+          }
+        }
+
+        if (m_cfg.avoidance && m_active)
+          avoid(pose);
+      }
+
+      void
+      onLeader(const PoseSample& pose)
+      {
+        if (!m_cfg.formation)
+          return;
+
+        LeaderFix fix;
+        fix.time = pose.time;
+        fix.lat = pose.lat;
+        fix.lon = pose.lon;
+        fix.psi = pose.psi;
+        fix.vx = pose.vx;
+        fix.vy = pose.vy;
+        fix.r = pose.r;
+        m_formation.update(fix);
+      }
+
+      //! Keep station in the formation slot. The reference is the
+      //! slot predicted a little ahead, and the speed is the leader's
+      //! trimmed by how far the vehicle is behind or ahead of its slot.
+      //! @param[in] pose vehicle pose.
+      void
+      follow(const PoseSample& pose)
+      {
+        bool known = m_formation.measure(pose.time, pose.lat, pose.lon,
+                                         m_cfg.horizontal_tolerance, m_cfg.s);
+
+        KpiSnapshot kpi;
+        std::memset(&kpi, 0, sizeof(kpi));
+        kpi.elapsed = m_formation.getElapsed(pose.time);
+        kpi.area = m_formation.getArea();
+        kpi.area_rate = kpi.elapsed > 0.0 ? kpi.area / kpi.elapsed * 3600.0 : 0.0;
+        kpi.remaining = -1.0;
+        kpi.eta = -1.0;
+        kpi.formation = true;
+        kpi.spacing_rms = m_formation.getErrorRms();
+        kpi.spacing_max = m_formation.getErrorMax();
+        m_kpi_out.publish(kpi);
+
+        // Without the leader the vehicle holds at the last reference.
+        m_leader_lost.store(!known, std::memory_order_relaxed);
+        if (!known)
+          return;
+
+        if (m_formation_time >= 0.0 && pose.time - m_formation_time < c_formation_period)
+          return;
+
+        double lat, lon, psi, speed;
+        m_formation.slot(pose.time, lat, lon, psi, speed);
+
+        double n, e;
+        WGS84::displacement(pose.lat, pose.lon, 0.0, lat, lon, 0.0, &n, &e);
+        double behind = n * std::cos(psi) + e * std::sin(psi);
+
+        Setpoint sp;
+        m_formation.slot(pose.time + m_cfg.formation_lead, sp.lat, sp.lon, psi, speed);
+        double limit = c_formation_max_speed * std::max(m_cfg.speed, speed);
+        sp.speed = std::max(0.0, std::min(speed + c_formation_gain * behind, limit));
+        sp.z = m_cfg.z;
+        sp.index = 0;
+        sp.count = 0;
+        sp.arrival = -1.0;
+        sp.complete = false;
+        sp.avoiding = false;
+        sp.returning = false;
+        sp.partial = false;
+        m_formation_time = pose.time;
+
+        // A slot outside the fence or over shallow water is not taken,
+        // the vehicle holds its last reference.
+        if (!checkFence(sp, pose.lat, pose.lon) || !checkDepth(sp, pose.lat, pose.lon))
+          return;
+
+        m_current = sp;
+        m_setpoint.publish(sp);
+      }
+
+      //! Check the vertical part of arrival, only enforced when
+      //! profiling.
+      //! @param[in] pose vehicle pose.
+      //! @return true if within vertical tolerance of the active setpoint.
+      bool
+      isLevel(const PoseSample& pose) const
+      {
+        if (!m_cfg.profiling)
+          return true;
+
+        double z = m_cfg.z_depth ? pose.depth : pose.alt;
+        return std::fabs(z - m_current.z) <= m_cfg.vertical_tolerance;
+      }
+
+      //! Feed a pose to the mission indicators.
+      //! @param[in] pose vehicle pose.
+      //! @param[in] x vehicle northing offset (m).
+      //! @param[in] y vehicle easting offset (m).
+      //! @param[in] arrived true if within tolerance of the active setpoint.
+      //! @return true if the route was cut short to return to base.
+      bool
+      updateKpi(const PoseSample& pose, double x, double y, bool arrived)
+      {
+        m_kpi.update(pose.time, x, y, pose.vx, pose.vy, pose.u, pose.psi, m_current.index,
+                     m_route[m_current.index].survey, m_current.speed, arrived);
+
+        KpiSnapshot kpi = m_kpi.get();
+        kpi.has_energy = m_energy.isValid() && kpi.eta >= 0.0;
+        if (kpi.has_energy)
+        {
+          // Fuel needed to finish the route and come back from its end.
+          size_t last = m_route.size() - 1;
+          double ret = returnTime(m_route[last].x, m_route[last].y, kpi);
+          double rate = m_energy.getRate(m_current.speed);
+          kpi.energy_margin = m_energy.getFuel() - rate * (kpi.eta + ret);
+        }
+
+        m_kpi_out.publish(kpi);
+
+        if (!m_cfg.endurance || !kpi.has_energy || m_returning
+            || kpi.energy_margin >= m_cfg.energy_reserve)
+          return false;
+
+        returnToBase(x, y, kpi);
+        return true;
+      }
+
+      //! Time to sail from a route position back to the origin.
+      //! @param[in] x northing offset (m).
+      //! @param[in] y easting offset (m).
+      //! @param[in] kpi indicators holding the current estimate.
+      //! @return time (s).
+      double
+      returnTime(double x, double y, const KpiSnapshot& kpi) const
+      {
+        double dist = std::sqrt(x * x + y * y);
+        if (dist <= 0.0)
+          return 0.0;
+
+        double gs = m_cfg.speed - (kpi.current_x * x + kpi.current_y * y) / dist;
+        return dist / std::max(gs, c_kpi_loiter_speed);
+      }
+
+      //! Cut the route short at the furthest leg boundary from which
+      //! the vehicle can still make it back with the reserve, and add
+      //! a return leg to the origin. Row ends are preferred so that
+      //! rows are not left half surveyed.
+      //! @param[in] x vehicle northing offset (m).
+      //! @param[in] y vehicle easting offset (m).
+      //! @param[in] kpi current indicators.
+      void
+      returnToBase(double x, double y, const KpiSnapshot& kpi)
+      {
+        double budget = m_energy.getFuel() - m_cfg.energy_reserve;
+        double rate = m_energy.getRate(m_cfg.speed);
+        double cx = kpi.current_x;
+        double cy = kpi.current_y;
+        double px = x;
+        double py = y;
+        double t = 0.0;
+        int best = -1;
+        int best_row = -1;
+
+        for (size_t j = m_current.index; j < m_route.size(); ++j)
+        {
+          double dx = m_route[j].x - px;
+          double dy = m_route[j].y - py;
+          double len = std::sqrt(dx * dx + dy * dy);
+          if (len > 0.0)
+            t += len / std::max(m_cfg.speed + (cx * dx + cy * dy) / len, c_kpi_loiter_speed);
+
+          px = m_route[j].x;
+          py = m_route[j].y;
+
+          if (rate * (t + returnTime(px, py, kpi)) > budget)
+            continue;
+
+          best = (int)j;
+          if (m_route[j].survey)
+            best_row = (int)j;
+        }
+
+        int stop = best_row >= 0 ? best_row : best;
+        size_t keep = stop >= 0 ? stop + 1 : m_current.index;
+
+        m_route.truncate(keep);
+        m_route.push(Waypoint(0.0, 0.0, m_cfg.z, false));
+        onRouteChanged();
+        m_returning = true;
+
+        if (stop >= 0)
+        {
+          // Keep the active setpoint, queue what is left after it.
+          requeue(resumeIndex(), m_current.lat, m_current.lon);
+
+          m_current.count = m_route.size();
+          m_current.returning = true;
+          if (!m_avoiding)
+          {
+            m_current.arrival = -1.0;
+            m_setpoint.publish(m_current);
+          }
+          return;
+        }
+
+        // Not even the active waypoint is affordable, head back now.
+        requeue(keep, m_pose.lat, m_pose.lon);
+        next();
+      }
+
+      void
+      onContact(const PlannerEvent& ev)
+      {
+        if (!m_cfg.avoidance || m_route.empty())
+          return;
+
+        double x, y;
+        m_route.toLocal(ev.pose.lat, ev.pose.lon, &x, &y);
+        m_contacts.update(ev.contact, ev.pose.time, x, y, ev.pose.psi, ev.pose.speed);
+      }
+
+      void
+      onDetection(const PlannerEvent& ev)
+      {
+        if (!m_cfg.adaptive || !m_active || m_returning)
+          return;
+
+        double x, y;
+        m_route.toLocal(ev.pose.lat, ev.pose.lon, &x, &y);
+        m_hotspots.add(x, y, ev.score);
+      }
+
+      //! Apply new route settings. Speed changes patch the setpoints
+      //! in place, geometry changes regenerate the legs not reached
+      //! yet. Either way the active waypoint is kept and the task only
+      //! ever sees complete setpoints.
+      void
+      onParams(const PlannerEvent& ev)
+      {
+        if (ev.speed != m_cfg.speed)
+        {
+          m_cfg.speed = ev.speed;
+          if (m_active)
+          {
+            m_queue.setSpeed(m_cfg.speed);
+            m_current.speed = m_cfg.speed;
+            if (!m_avoiding)
+            {
+              m_current.arrival = -1.0;
+              m_setpoint.publish(m_current);
+            }
+          }
+        }
+
+        if (!ev.geometry)
+          return;
+
+        m_cfg.rows = ev.rows;
+        m_cfg.h = ev.h;
+        m_cfg.s = ev.s;
+        m_cfg.z = ev.z;
+
+        // A route cut short to return to base is not extended again.
+        if (m_active && !m_returning)
+          regenerate();
+      }
+
+      //! Replace the lawnmower legs after the active waypoint.
+      void
+      regenerate(void)
+      {
+        size_t anchor = m_current.index;
+        while (anchor > 0 && m_route[anchor].row < 0)
+          --anchor;
+
+        if (m_route[anchor].row < 0)
+          return;
+
+        // Finish a refinement pattern in progress first.
+        size_t keep = m_current.index;
+        while (keep + 1 < m_route.size() && m_route[keep + 1].row < 0)
+          ++keep;
+
+        Waypoint from = m_route[anchor];
+        m_route.extendLawnmower(keep, from, m_cfg.rows, m_cfg.h, m_cfg.s, m_cfg.z);
+        onRouteChanged();
+        m_current.count = m_route.size();
+
+        m_profile.resume(m_current.z);
+        requeue(resumeIndex(), m_current.lat, m_current.lon);
+      }
+
+      //! Update what depends on the route geometry. Distances along
+      //! the route up to the active waypoint never change, so the
+      //! coverage frontier stays valid.
+      void
+      onRouteChanged(void)
+      {
+        m_kpi.setRoute(m_route);
+        if (m_cfg.rejoin)
+          m_index.build(m_route);
+      }
+
+      //! Advance the coverage frontier while the vehicle stays on the
+      //! route, and send it back there if it drifted off a survey leg.
+      //! @param[in] x vehicle northing offset (m).
+      //! @param[in] y vehicle easting offset (m).
+      //! @return true if the vehicle was sent back.
+      bool
+      track(double x, double y)
+      {
+        if (m_avoiding || m_returning)
+          return false;
+
+        // Only look a little ahead so that coverage has no gaps, and
+        // never past the active waypoint.
+        double end = std::min(m_frontier + 2.0 * m_cfg.horizontal_tolerance,
+                              m_index.getArc(m_current.index));
+
+        RoutePoint pt;
+        if (!m_index.nearest(x, y, m_frontier, end, pt))
+          return false;
+
+        if (pt.distance <= m_cfg.horizontal_tolerance)
+        {
+          m_frontier = std::max(m_frontier, pt.arc);
+          return false;
+        }
+
+        if (m_rejoining || !m_route[pt.segment].survey
+            || pt.distance < c_rejoin_drift * m_cfg.horizontal_tolerance)
+          return false;
+
+        return rejoin();
+      }
+
+      //! Plan resumed after an interruption.
+      void
+      onRejoin(void)
+      {
+        if (m_cfg.rejoin && m_active && !m_returning && !m_avoiding)
+          rejoin();
+      }
+
+      //! Head back to the coverage frontier. A waypoint is inserted
+      //! there unless it is next to an existing one, and the route is
+      //! followed again from it.
+      //! @return false if nothing was left behind.
+      bool
+      rejoin(void)
+      {
+        RoutePoint pt;
+        if (!m_index.locate(m_frontier, pt))
+          return false;
+
+        size_t k = pt.segment;
+        double end = m_index.getArc(k);
+
+        // Gaps only matter on survey legs.
+        if (!m_route[k].survey
+            || (k == m_current.index && end - m_frontier <= m_cfg.horizontal_tolerance))
+          return false;
+
+        size_t target = k;
+        if (end - pt.arc >= c_rejoin_snap)
+        {
+          if (k > 0 && pt.arc - m_index.getArc(k - 1) < c_rejoin_snap)
+          {
+            target = k - 1;
+          }
+          else
+          {
+            Waypoint wp = m_route[k];
+            wp.x = pt.x;
+            wp.y = pt.y;
+            m_route.insert(k, std::vector<Waypoint>(1, wp));
+            onRouteChanged();
+          }
+        }
+
+        m_profile.resume(m_current.z);
+        requeue(target, m_pose.lat, m_pose.lon);
+        m_arrival = -1.0;
+        // Neither here nor at the target, which is not a leg end, are
+        // sub-patterns inserted.
+        m_rejoining = true;
+        next();
+        return true;
+      }
+
+      //! Insert fine sub-patterns over pending hotspots right after
+      //! the waypoint just reached, then resume the coarse sweep.
+      void
+      refine(void)
+      {
+        double x, y;
+        m_route.toLocal(m_current.lat, m_current.lon, &x, &y);
+        m_hotspots.takePatterns(x, y, m_cfg.s / m_cfg.refinement, m_cfg.z, m_patterns);
+
+        size_t at = m_current.index + 1;
+        m_route.insert(at, m_patterns);
+        onRouteChanged();
+        m_refinements.store(m_hotspots.getRefined(), std::memory_order_relaxed);
+
+        m_profile.resume(m_current.z);
+        requeue(at, m_current.lat, m_current.lon);
+      }
+
+      //! Deflect the reference away from contacts on a collision
+      //! course, and hand back the survey setpoint once clear.
+      //! @param[in] pose vehicle pose.
+      void
+      avoid(const PoseSample& pose)
+      {
+        m_contacts.expire(pose.time, m_cfg.contact_timeout);
+
+        double x, y, tx, ty;
+        m_route.toLocal(pose.lat, pose.lon, &x, &y);
+        m_route.toLocal(m_current.lat, m_current.lon, &tx, &ty);
+
+        double heading = std::atan2(ty - y, tx - x);
+        double reach = m_cfg.avoidance_horizon * (m_current.speed + c_max_contact_speed);
+        m_contacts.query(x, y, m_cfg.safety_radius + reach, m_nearby);
+
+        double safe_heading, safe_speed;
+        if (!m_vo.choose(x, y, pose.time, heading, m_current.speed, m_nearby,
+                         safe_heading, safe_speed))
+        {
+          if (m_avoiding)
+          {
+            m_avoiding = false;
+            if (m_cfg.rejoin && rejoin())
+              return;
+
+            m_current.arrival = -1.0;
+            m_setpoint.publish(m_current);
+          }
+
+          return;
+        }
+
+        double change = std::fabs(Angles::normalizeRadian(safe_heading - m_avoid_heading));
+        if (m_avoiding && pose.time - m_avoid_time < c_avoid_period
+            && change < c_avoid_heading_change)
+          return;
+
+        // Target far enough ahead that the vehicle does not arrive
+        // before the next update.
+        double ahead = std::max(2.0 * m_cfg.safety_radius, 3.0 * m_current.speed * c_avoid_period);
+
+        Setpoint sp = m_current;
+        m_route.toGeodetic(x + ahead * std::cos(safe_heading), y + ahead * std::sin(safe_heading),
+                           &sp.lat, &sp.lon);
+        sp.speed = safe_speed;
+        sp.arrival = -1.0;
+        sp.avoiding = true;
+
+        // Never dodge out of the fence or into shallow water, hold
+        // position instead.
+        if (!checkFence(sp, pose.lat, pose.lon) || !checkDepth(sp, pose.lat, pose.lon))
+        {
+          sp.lat = pose.lat;
+          sp.lon = pose.lon;
+          sp.z = m_current.z;
+        }
+
+        m_setpoint.publish(sp);
+
+        m_avoiding = true;
+        m_avoid_time = pose.time;
+        m_avoid_heading = safe_heading;
+      }
+
+      void
+      onFollowRef(const PlannerEvent& ev)
+      {
+        // Formation references do not wait for arrival, and with a
+        // day schedule the reports belong to the job plans.
+        if (m_cfg.formation || m_cfg.scheduling)
+          return;
+
+        if (!m_active)
+        {
+          if (m_route.empty() && m_has_pose)
+            startRoute();
+          return;
+        }
+
+        if (!(ev.proximity & IMC::FollowRefState::PROX_XY_NEAR))
+          return;
+
+        if (m_cfg.profiling && !(ev.proximity & IMC::FollowRefState::PROX_Z_NEAR))
+          return;
+
+        // Ignore reports about a reference we already moved past.
+        if (!ev.has_ref || ev.ref_lat != m_current.lat || ev.ref_lon != m_current.lon)
+          return;
+
+        if (m_arrival < 0.0)
+          m_arrival = ev.pose.time;
+
+        next();
+        m_rejoining = false;
+      }
+
+      //! Generate the survey route at the current position and
+      //! publish the first setpoint.
+      void
+      startRoute(void)
+      {
+        m_route.setOrigin(m_pose.lat, m_pose.lon);
+        m_route.lawnmower(m_cfg.rows, m_cfg.h, m_cfg.s, m_cfg.z);
+        if (m_cfg.depth != NULL && m_cfg.skip_known)
+          skipKnownRows();
+        m_kpi.reset(m_route, m_cfg.s);
+        if (m_cfg.rejoin)
+          m_index.build(m_route);
+        m_returning = false;
+        m_frontier = 0.0;
+        m_rejoining = false;
+
+        if (m_cfg.adaptive)
+          m_hotspots.setup(m_cfg.rows * m_cfg.s, m_cfg.h, m_cfg.s, m_cfg.hotspot_score,
+                           m_cfg.max_refinements);
+
+        if (m_cfg.profiling)
+        {
+          m_profile.setup(m_cfg.profile_min_z, m_cfg.profile_max_z, m_cfg.profile_pitch,
+                          m_cfg.profile_step);
+          m_profile.resume(m_cfg.z_depth ? m_pose.depth : m_pose.alt);
+        }
+
+        m_active = true;
+        m_arrival = -1.0;
+        requeue(0, m_pose.lat, m_pose.lon);
+        next();
+      }
+
+      //! Route waypoint to continue from when the queued setpoints
+      //! are dropped. A leg left halfway is finished first.
+      //! @return waypoint index.
+      size_t
+      resumeIndex(void) const
+      {
+        return m_current.partial ? m_current.index : m_current.index + 1;
+      }
+
+      //! Drop queued setpoints and queue again from a route waypoint.
+      //! @param[in] index first route waypoint to queue.
+      //! @param[in] lat latitude the first leg starts from (rad).
+      //! @param[in] lon longitude the first leg starts from (rad).
+      void
+      requeue(size_t index, double lat, double lon)
+      {
+        m_queue.clear();
+        m_leg.clear();
+        m_leg_next = 0;
+        m_next_wp = index;
+        m_last_lat = lat;
+        m_last_lon = lon;
+        fill();
+      }
+
+      //! Compute setpoints for upcoming waypoints until the queue is full.
+      void
+      fill(void)
+      {
+        Setpoint sp;
+        sp.count = m_route.size();
+        sp.arrival = -1.0;
+        sp.complete = false;
+        sp.avoiding = false;
+        sp.returning = m_returning;
+        sp.speed = m_cfg.speed;
+
+        // The way home is sailed level.
+        bool profiling = m_cfg.profiling && !m_returning;
+
+        while (!m_queue.full())
+        {
+          if (m_leg_next < m_leg.size())
+          {
+            const Waypoint& wp = m_leg[m_leg_next++];
+            m_route.toGeodetic(wp.x, wp.y, &sp.lat, &sp.lon);
+            sp.z = std::min(wp.z, m_leg_floor);
+            sp.index = m_leg_index;
+            sp.partial = m_leg_next < m_leg.size();
+            m_queue.push(sp);
+            continue;
+          }
+
+          if (m_next_wp >= m_route.size())
+            break;
+
+          m_route.getPosition(m_next_wp, &sp.lat, &sp.lon);
+          // When profiling, the depth check turns the deepest z into
+          // the floor allowed along the leg.
+          sp.z = profiling ? m_cfg.profile_max_z : m_route[m_next_wp].z;
+          sp.index = m_next_wp++;
+          sp.partial = false;
+
+          if (!checkFence(sp, m_last_lat, m_last_lon) || !checkDepth(sp, m_last_lat, m_last_lon))
+            continue;
+
+          if (profiling)
+          {
+            double x0, y0;
+            Waypoint to = m_route[sp.index];
+            m_route.toLocal(m_last_lat, m_last_lon, &x0, &y0);
+            m_route.toLocal(sp.lat, sp.lon, &to.x, &to.y);
+            m_profile.leg(x0, y0, to, m_leg);
+            m_leg_next = 0;
+            m_leg_index = sp.index;
+            m_leg_floor = sp.z;
+          }
+          else
+          {
+            m_queue.push(sp);
+          }
+
+          m_last_lat = sp.lat;
+          m_last_lon = sp.lon;
+        }
+      }
+
+      //! Validate a setpoint and the leg leading to it.
+      //! @param[in,out] sp setpoint, moved inside if clamping is enabled.
+      //! @param[in] lat0 latitude the leg starts from (rad).
+      //! @param[in] lon0 longitude the leg starts from (rad).
+      //! @return false if the setpoint must be skipped.
+      bool
+      checkFence(Setpoint& sp, double lat0, double lon0)
+      {
+        if (m_cfg.fence == NULL || !m_cfg.fence->isEnabled())
+          return true;
+
+        if (!m_cfg.fence->contains(sp.lat, sp.lon))
+        {
+          if (!m_cfg.fence_clamp || !m_cfg.fence->clamp(sp.lat, sp.lon, m_cfg.fence_margin))
+          {
+            m_fence_rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+          }
+
+          m_fence_clamped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (!m_cfg.fence->isLegValid(lat0, lon0, sp.lat, sp.lon))
+        {
+          m_fence_rejected.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+
+        return true;
+      }
+
+      //! Check a leg against the depth map and keep depth references
+      //! clear of the seabed.
+      //! @param[in,out] sp setpoint, its z may be reduced.
+      //! @param[in] lat0 latitude the leg starts from (rad).
+      //! @param[in] lon0 longitude the leg starts from (rad).
+      //! @return false if the leg crosses shallow water.
+      bool
+      checkDepth(Setpoint& sp, double lat0, double lon0)
+      {
+        float shallowest, known;
+        if (m_cfg.depth == NULL
+            || !m_cfg.depth->queryLeg(lat0, lon0, sp.lat, sp.lon, shallowest, known))
+          return true;
+
+        if (shallowest < m_cfg.min_depth)
+        {
+          m_shallow.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+
+        if (m_cfg.z_depth)
+          sp.z = std::max(0.0, std::min((double)sp.z, shallowest - m_cfg.clearance));
+
+        return true;
+      }
+
+      //! Remove survey rows lying over mapped seabed. Both ends of a
+      //! mapped row are dropped and the vehicle transits past it.
+      void
+      skipKnownRows(void)
+      {
+        std::vector<Waypoint> wps;
+        std::vector<bool> drop(m_route.size(), false);
+        double lat0 = m_pose.lat;
+        double lon0 = m_pose.lon;
+
+        for (size_t j = 0; j < m_route.size(); ++j)
+        {
+          double lat1, lon1;
+          m_route.getPosition(j, &lat1, &lon1);
+
+          float shallowest, known;
+          if (m_route[j].survey
+              && m_cfg.depth->queryLeg(lat0, lon0, lat1, lon1, shallowest, known)
+              && known >= c_depth_known_coverage)
+          {
+            drop[j] = true;
+            if (j > 0)
+              drop[j - 1] = true;
+            m_skipped.fetch_add(1, std::memory_order_relaxed);
+          }
+
+          lat0 = lat1;
+          lon0 = lon1;
+        }
+
+        bool transit = false;
+        for (size_t j = 0; j < m_route.size(); ++j)
+        {
+          if (drop[j])
+          {
+            transit = true;
+            continue;
+          }
+
+          wps.push_back(m_route[j]);
+          if (transit)
+            wps.back().survey = false;
+          transit = false;
+        }
+
+        m_route.clear();
+        m_route.insert(0, wps);
+      }
+
+      //! Publish the next queued setpoint.
+      void
+      next(void)
+      {
+        // Sub-patterns start where a leg ends, not halfway through it
+        // nor at the point a leg is rejoined.
+        if (m_active && !m_returning && !m_current.partial && !m_rejoining
+            && m_hotspots.hasPending())
+          refine();
+
+        if (m_queue.empty())
+        {
+          // Keep loitering at the last waypoint.
+          m_active = false;
+          m_current.complete = true;
+          m_current.arrival = m_arrival;
+          m_setpoint.publish(m_current);
+          return;
+        }
+
+        m_current = m_queue.front();
+        m_current.arrival = m_arrival;
+        m_queue.pop();
+        m_avoiding = false;
+        m_setpoint.publish(m_current);
+
+        // Waypoints reached or skipped count as covered.
+        if (m_cfg.rejoin && m_current.index > 0)
+          m_frontier = std::max(m_frontier, m_index.getArc(m_current.index - 1));
+
+        m_arrival = -1.0;
+        fill();
+      }
+    };
+  }
+}
+
+#endif
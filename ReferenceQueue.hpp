@@ -0,0 +1,165 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_REFERENCE_QUEUE_HPP_INCLUDED_
+#define MANEUVER_TEST_REFERENCE_QUEUE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Reference target for a route waypoint.
+    struct Setpoint
+    {
+      //! Latitude (rad).
+      double lat;
+      //! Longitude (rad).
+      double lon;
+      //! Vertical reference (m).
+      float z;
+      //! Speed (m/s).
+      float speed;
+      //! Route waypoint index.
+      uint32_t index;
+      //! Number of route waypoints.
+      uint32_t count;
+      //! Time the vehicle arrived at the previous setpoint, negative if unknown.
+      double arrival;
+      //! True when the route is complete and no new reference follows.
+      bool complete;
+      //! True if this is a temporary target steering clear of a contact.
+      bool avoiding;
+      //! True once the route was cut short to return to base.
+      bool returning;
+      //! True if this is a profile point short of the route waypoint.
+      bool partial;
+    };
+
+    //! Fixed capacity ring of setpoints computed ahead of time, so
+    //! that a leg transition only has to pop the next entry.
+    class ReferenceQueue
+    {
+    public:
+      //! Constructor.
+      //! @param[in] capacity maximum number of queued setpoints.
+      ReferenceQueue(unsigned capacity = 1)
+      {
+        resize(capacity);
+      }
+
+      //! Change capacity, dropping queued setpoints.
+      //! @param[in] capacity maximum number of queued setpoints.
+      void
+      resize(unsigned capacity)
+      {
+        m_refs.resize(capacity < 1 ? 1 : capacity);
+        clear();
+      }
+
+      //! Queue a setpoint.
+      //! @param[in] ref setpoint.
+      //! @return false if the queue is full.
+      bool
+      push(const Setpoint& ref)
+      {
+        if (full())
+          return false;
+
+        m_refs[(m_head + m_size) % m_refs.size()] = ref;
+        ++m_size;
+        return true;
+      }
+
+      //! Oldest queued setpoint.
+      const Setpoint&
+      front(void) const
+      {
+        return m_refs[m_head];
+      }
+
+      //! Drop oldest queued setpoint.
+      void
+      pop(void)
+      {
+        m_head = (m_head + 1) % m_refs.size();
+        --m_size;
+      }
+
+      bool
+      empty(void) const
+      {
+        return m_size == 0;
+      }
+
+      bool
+      full(void) const
+      {
+        return m_size == m_refs.size();
+      }
+
+      size_t
+      size(void) const
+      {
+        return m_size;
+      }
+
+      //! Change the speed of all queued setpoints.
+      //! @param[in] speed speed (m/s).
+      void
+      setSpeed(float speed)
+      {
+        for (size_t i = 0; i < m_size; ++i)
+          m_refs[(m_head + i) % m_refs.size()].speed = speed;
+      }
+
+      void
+      clear(void)
+      {
+        m_head = 0;
+        m_size = 0;
+      }
+
+    private:
+      //! Setpoint storage.
+      std::vector<Setpoint> m_refs;
+      //! Slot of the oldest reference.
+      size_t m_head;
+      //! Number of queued references.
+      size_t m_size;
+    };
+  }
+}
+
+#endif
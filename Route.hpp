@@ -0,0 +1,243 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_ROUTE_HPP_INCLUDED_
+#define MANEUVER_TEST_ROUTE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    using DUNE_NAMESPACES;
+
+    //! Route waypoint, relative to the route origin.
+    struct Waypoint
+    {
+      //! Northing offset (m).
+      double x;
+      //! Easting offset (m).
+      double y;
+      //! Vertical reference (m).
+      double z;
+      //! True if the leg ending here is a survey row, false for transit.
+      bool survey;
+      //! Lawnmower row this waypoint ends or leaves, negative if not
+      //! part of the lawnmower.
+      int row;
+
+      Waypoint(double wx = 0.0, double wy = 0.0, double wz = 0.0, bool wsurvey = true,
+               int wrow = -1):
+        x(wx),
+        y(wy),
+        z(wz),
+        survey(wsurvey),
+        row(wrow)
+      { }
+    };
+
+    //! Survey route made of waypoints expressed in a local
+    //! north-east frame anchored at the origin.
+    class Route
+    {
+    public:
+      Route(void):
+        m_lat(0.0),
+        m_lon(0.0)
+      { }
+
+      //! Set route origin.
+      //! @param[in] lat origin latitude (rad).
+      //! @param[in] lon origin longitude (rad).
+      void
+      setOrigin(double lat, double lon)
+      {
+        m_lat = lat;
+        m_lon = lon;
+      }
+
+      //! Replace waypoints by a lawnmower pattern starting at the
+      //! origin. Rows run east for the longitudinal distance and are
+      //! spaced north by the latitudinal distance.
+      //! @param[in] rows number of rows.
+      //! @param[in] h row length (m).
+      //! @param[in] s row spacing (m).
+      //! @param[in] z vertical reference (m).
+      void
+      lawnmower(unsigned rows, double h, double s, double z)
+      {
+        m_wps.clear();
+
+        for (unsigned i = 0; i < rows; ++i)
+        {
+          double east = (i % 2 == 0) ? h : 0.0;
+          m_wps.push_back(Waypoint(i * s, east, z, true, i));
+          m_wps.push_back(Waypoint((i + 1) * s, east, z, false, i));
+        }
+      }
+
+      //! Replace the lawnmower rows after a waypoint by rows with new
+      //! settings, continuing from where the given lawnmower waypoint
+      //! leaves off. Waypoints up to index are kept.
+      //! @param[in] index last waypoint kept.
+      //! @param[in] anchor lawnmower waypoint to continue from.
+      //! @param[in] rows total number of rows.
+      //! @param[in] h row length (m).
+      //! @param[in] s row spacing (m).
+      //! @param[in] z vertical reference (m).
+      void
+      extendLawnmower(size_t index, const Waypoint& anchor, unsigned rows,
+                      double h, double s, double z)
+      {
+        truncate(index + 1);
+
+        double x = anchor.x;
+        double east = anchor.y;
+        int row = anchor.row;
+
+        // A finished row still needs its transit to the next one.
+        if (anchor.survey)
+        {
+          x += s;
+          m_wps.push_back(Waypoint(x, east, z, false, row));
+        }
+
+        for (++row; row < (int)rows; ++row)
+        {
+          east = east > 0.0 ? 0.0 : h;
+          m_wps.push_back(Waypoint(x, east, z, true, row));
+          x += s;
+          m_wps.push_back(Waypoint(x, east, z, false, row));
+        }
+      }
+
+      //! Get geodetic position of a waypoint.
+      //! @param[in] index waypoint index.
+      //! @param[out] lat latitude (rad).
+      //! @param[out] lon longitude (rad).
+      void
+      getPosition(size_t index, double* lat, double* lon) const
+      {
+        *lat = m_lat;
+        *lon = m_lon;
+        WGS84::displace(m_wps[index].x, m_wps[index].y, lat, lon);
+      }
+
+      //! Convert a geodetic position to the route frame.
+      //! @param[in] lat latitude (rad).
+      //! @param[in] lon longitude (rad).
+      //! @param[out] x northing offset (m).
+      //! @param[out] y easting offset (m).
+      void
+      toLocal(double lat, double lon, double* x, double* y) const
+      {
+        WGS84::displacement(m_lat, m_lon, 0.0, lat, lon, 0.0, x, y);
+      }
+
+      //! Convert a route frame position to geodetic coordinates.
+      //! @param[in] x northing offset (m).
+      //! @param[in] y easting offset (m).
+      //! @param[out] lat latitude (rad).
+      //! @param[out] lon longitude (rad).
+      void
+      toGeodetic(double x, double y, double* lat, double* lon) const
+      {
+        *lat = m_lat;
+        *lon = m_lon;
+        WGS84::displace(x, y, lat, lon);
+      }
+
+      const Waypoint&
+      operator[](size_t index) const
+      {
+        return m_wps[index];
+      }
+
+      size_t
+      size(void) const
+      {
+        return m_wps.size();
+      }
+
+      bool
+      empty(void) const
+      {
+        return m_wps.empty();
+      }
+
+      void
+      clear(void)
+      {
+        m_wps.clear();
+      }
+
+      //! Drop waypoints past a given count.
+      //! @param[in] count number of waypoints to keep.
+      void
+      truncate(size_t count)
+      {
+        if (count < m_wps.size())
+          m_wps.resize(count);
+      }
+
+      //! Insert waypoints.
+      //! @param[in] index position of the first inserted waypoint.
+      //! @param[in] wps waypoints.
+      void
+      insert(size_t index, const std::vector<Waypoint>& wps)
+      {
+        m_wps.insert(m_wps.begin() + std::min(index, m_wps.size()), wps.begin(), wps.end());
+      }
+
+      //! Append a waypoint.
+      //! @param[in] wp waypoint.
+      void
+      push(const Waypoint& wp)
+      {
+        m_wps.push_back(wp);
+      }
+
+    private:
+      //! Origin latitude (rad).
+      double m_lat;
+      //! Origin longitude (rad).
+      double m_lon;
+      //! Waypoints.
+      std::vector<Waypoint> m_wps;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,368 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_ROUTE_INDEX_HPP_INCLUDED_
+#define MANEUVER_TEST_ROUTE_INDEX_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "Route.hpp"
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Children per route index node.
+    static const unsigned c_route_index_fanout = 16;
+
+    //! Point on a route.
+    struct RoutePoint
+    {
+      //! Segment, equal to the waypoint it leads to.
+      size_t segment;
+      //! Northing (m).
+      double x;
+      //! Easting (m).
+      double y;
+      //! Distance along the route from the origin (m).
+      double arc;
+      //! Distance from the query position (m).
+      double distance;
+    };
+
+    //! Static R-tree over route segments, packed by sorting tiles, with
+    //! the arc length range of every node so that nearest segment
+    //! queries can be limited to a stretch of the route. Segment k
+    //! runs from waypoint k - 1, or the route origin, to waypoint k.
+    class RouteIndex
+    {
+    public:
+      //! Index a route.
+      //! @param[in] route route.
+      void
+      build(const Route& route)
+      {
+        size_t n = route.size();
+        m_x.resize(n + 1);
+        m_y.resize(n + 1);
+        m_arc.resize(n + 1);
+        m_nodes.clear();
+        m_x[0] = 0.0;
+        m_y[0] = 0.0;
+        m_arc[0] = 0.0;
+
+        for (size_t k = 0; k < n; ++k)
+        {
+          m_x[k + 1] = route[k].x;
+          m_y[k + 1] = route[k].y;
+          double dx = m_x[k + 1] - m_x[k];
+          double dy = m_y[k + 1] - m_y[k];
+          m_arc[k + 1] = m_arc[k] + std::sqrt(dx * dx + dy * dy);
+        }
+
+        if (n == 0)
+          return;
+
+        // Leaves, one per segment, tiled by northing then easting.
+        std::vector<size_t> order(n);
+        for (size_t k = 0; k < n; ++k)
+          order[k] = k;
+
+        std::sort(order.begin(), order.end(), ByCenter(this, true));
+        size_t leaves = (n + c_route_index_fanout - 1) / c_route_index_fanout;
+        size_t slices = (size_t)std::ceil(std::sqrt((double)leaves));
+        size_t per_slice = slices * c_route_index_fanout;
+        for (size_t i = 0; i < n; i += per_slice)
+          std::sort(order.begin() + i, order.begin() + std::min(n, i + per_slice), ByCenter(this, false));
+
+        m_segments = order;
+        for (size_t i = 0; i < n; i += c_route_index_fanout)
+        {
+          Node node;
+          node.first = i;
+          node.count = std::min<size_t>(c_route_index_fanout, n - i);
+          node.leaf = true;
+          bound(node);
+          m_nodes.push_back(node);
+        }
+
+        // Upper levels over consecutive nodes of the level below.
+        size_t begin = 0;
+        size_t end = m_nodes.size();
+        while (end - begin > 1)
+        {
+          for (size_t i = begin; i < end; i += c_route_index_fanout)
+          {
+            Node node;
+            node.first = i;
+            node.count = std::min<size_t>(c_route_index_fanout, end - i);
+            node.leaf = false;
+            bound(node);
+            m_nodes.push_back(node);
+          }
+
+          begin = end;
+          end = m_nodes.size();
+        }
+      }
+
+      //! Number of indexed segments.
+      size_t
+      size(void) const
+      {
+        return m_segments.size();
+      }
+
+      //! Distance along the route at a waypoint (m).
+      //! @param[in] index waypoint index.
+      double
+      getArc(size_t index) const
+      {
+        return m_arc[index + 1];
+      }
+
+      //! Route length (m).
+      double
+      getLength(void) const
+      {
+        return m_arc.empty() ? 0.0 : m_arc.back();
+      }
+
+      //! Find the point at a given distance along the route.
+      //! @param[in] arc distance along the route (m).
+      //! @param[out] pt route point.
+      //! @return false if the route is empty.
+      bool
+      locate(double arc, RoutePoint& pt) const
+      {
+        if (m_segments.empty())
+          return false;
+
+        arc = std::max(0.0, std::min(arc, getLength()));
+        size_t k = std::lower_bound(m_arc.begin() + 1, m_arc.end(), arc) - m_arc.begin() - 1;
+        k = std::min(k, m_segments.size() - 1);
+        project(k, arc, arc, m_x[k], m_y[k], pt);
+        pt.distance = 0.0;
+        return true;
+      }
+
+      //! Find the route point nearest to a position within a stretch
+      //! of the route.
+      //! @param[in] x northing (m).
+      //! @param[in] y easting (m).
+      //! @param[in] arc_min start of the stretch (m).
+      //! @param[in] arc_max end of the stretch (m).
+      //! @param[out] pt nearest point.
+      //! @return false if no segment lies in the stretch.
+      bool
+      nearest(double x, double y, double arc_min, double arc_max, RoutePoint& pt)
+      {
+        if (m_nodes.empty() || arc_max < arc_min)
+          return false;
+
+        double best = std::numeric_limits<double>::infinity();
+        m_heap.clear();
+        push(m_nodes.size() - 1, x, y);
+
+        while (!m_heap.empty() && m_heap.front().first < best)
+        {
+          std::pop_heap(m_heap.begin(), m_heap.end(), Farther());
+          const Node& node = m_nodes[m_heap.back().second];
+          m_heap.pop_back();
+
+          if (node.arc_max < arc_min || node.arc_min > arc_max)
+            continue;
+
+          for (size_t i = node.first; i < node.first + node.count; ++i)
+          {
+            if (!node.leaf)
+            {
+              push(i, x, y);
+              continue;
+            }
+
+            size_t k = m_segments[i];
+            if (m_arc[k + 1] < arc_min || m_arc[k] > arc_max)
+              continue;
+
+            RoutePoint cand;
+            project(k, arc_min, arc_max, x, y, cand);
+            double dx = cand.x - x;
+            double dy = cand.y - y;
+            double d = dx * dx + dy * dy;
+            if (d < best)
+            {
+              best = d;
+              pt = cand;
+            }
+          }
+        }
+
+        if (best == std::numeric_limits<double>::infinity())
+          return false;
+
+        pt.distance = std::sqrt(best);
+        return true;
+      }
+
+    private:
+      //! Tree node.
+      struct Node
+      {
+        //! Bounding box.
+        double min_x, min_y, max_x, max_y;
+        //! Arc length range covered (m).
+        double arc_min, arc_max;
+        //! First child node, or first entry of m_segments for leaves.
+        size_t first;
+        //! Number of children.
+        size_t count;
+        //! True if children are segments.
+        bool leaf;
+      };
+
+      //! Orders segments by the northing or easting of their center.
+      struct ByCenter
+      {
+        const RouteIndex* index;
+        bool north;
+
+        ByCenter(const RouteIndex* i, bool n):
+          index(i),
+          north(n)
+        { }
+
+        bool
+        operator()(size_t a, size_t b) const
+        {
+          const std::vector<double>& v = north ? index->m_x : index->m_y;
+          return v[a] + v[a + 1] < v[b] + v[b + 1];
+        }
+      };
+
+      //! Orders heap entries nearest first.
+      struct Farther
+      {
+        bool
+        operator()(const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) const
+        {
+          return a.first > b.first;
+        }
+      };
+
+      //! Route points, the origin first.
+      std::vector<double> m_x;
+      std::vector<double> m_y;
+      //! Distance along the route at each point (m).
+      std::vector<double> m_arc;
+      //! Segments in leaf order.
+      std::vector<size_t> m_segments;
+      //! Nodes, leaves first, root last.
+      std::vector<Node> m_nodes;
+      //! Search queue of squared box distances, reused across queries.
+      std::vector<std::pair<double, size_t> > m_heap;
+
+      //! Compute the bounding box and arc range of a node.
+      void
+      bound(Node& node) const
+      {
+        node.min_x = node.min_y = node.arc_min = std::numeric_limits<double>::infinity();
+        node.max_x = node.max_y = node.arc_max = -std::numeric_limits<double>::infinity();
+
+        for (size_t i = node.first; i < node.first + node.count; ++i)
+        {
+          if (node.leaf)
+          {
+            size_t k = m_segments[i];
+            node.min_x = std::min(node.min_x, std::min(m_x[k], m_x[k + 1]));
+            node.max_x = std::max(node.max_x, std::max(m_x[k], m_x[k + 1]));
+            node.min_y = std::min(node.min_y, std::min(m_y[k], m_y[k + 1]));
+            node.max_y = std::max(node.max_y, std::max(m_y[k], m_y[k + 1]));
+            node.arc_min = std::min(node.arc_min, m_arc[k]);
+            node.arc_max = std::max(node.arc_max, m_arc[k + 1]);
+            continue;
+          }
+
+          const Node& c = m_nodes[i];
+          node.min_x = std::min(node.min_x, c.min_x);
+          node.max_x = std::max(node.max_x, c.max_x);
+          node.min_y = std::min(node.min_y, c.min_y);
+          node.max_y = std::max(node.max_y, c.max_y);
+          node.arc_min = std::min(node.arc_min, c.arc_min);
+          node.arc_max = std::max(node.arc_max, c.arc_max);
+        }
+      }
+
+      //! Queue a node by its squared distance to a position.
+      void
+      push(size_t index, double x, double y)
+      {
+        const Node& node = m_nodes[index];
+        double dx = std::max(0.0, std::max(node.min_x - x, x - node.max_x));
+        double dy = std::max(0.0, std::max(node.min_y - y, y - node.max_y));
+        m_heap.push_back(std::make_pair(dx * dx + dy * dy, index));
+        std::push_heap(m_heap.begin(), m_heap.end(), Farther());
+      }
+
+      //! Project a position on the part of a segment within an arc range.
+      void
+      project(size_t k, double arc_min, double arc_max, double x, double y,
+              RoutePoint& pt) const
+      {
+        double dx = m_x[k + 1] - m_x[k];
+        double dy = m_y[k + 1] - m_y[k];
+        double len = m_arc[k + 1] - m_arc[k];
+        double t = 0.0;
+
+        if (len > 0.0)
+        {
+          t = ((x - m_x[k]) * dx + (y - m_y[k]) * dy) / (len * len);
+          double lo = (arc_min - m_arc[k]) / len;
+          double hi = (arc_max - m_arc[k]) / len;
+          t = std::max(std::max(0.0, lo), std::min(t, std::min(1.0, hi)));
+        }
+
+        pt.segment = k;
+        pt.x = m_x[k] + t * dx;
+        pt.y = m_y[k] + t * dy;
+        pt.arc = m_arc[k] + t * len;
+      }
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,116 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_SPSC_RING_HPP_INCLUDED_
+#define MANEUVER_TEST_SPSC_RING_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cstddef>
+#include <vector>
+
+// ISO C++ 11 headers.
+#include <atomic>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Lock-free ring buffer for exactly one producer thread and one
+    //! consumer thread. Elements are copied in and out, so T should
+    //! be a plain data type.
+    template <typename T>
+    class SpscRing
+    {
+    public:
+      //! Constructor.
+      //! @param[in] capacity minimum capacity, rounded up to a power of two.
+      SpscRing(unsigned capacity):
+        m_head(0),
+        m_tail(0)
+      {
+        unsigned size = 2;
+        while (size < capacity)
+          size <<= 1;
+
+        m_items.resize(size);
+        m_mask = size - 1;
+      }
+
+      //! Append an element. Producer side only.
+      //! @param[in] item element.
+      //! @return false if the ring is full.
+      bool
+      push(const T& item)
+      {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+          return false;
+
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+      }
+
+      //! Remove the oldest element. Consumer side only.
+      //! @param[out] item element.
+      //! @return false if the ring is empty.
+      bool
+      pop(T& item)
+      {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+          return false;
+
+        item = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+      }
+
+      //! Check if the ring is empty. Only a hint when called
+      //! concurrently with push().
+      bool
+      empty(void) const
+      {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+      }
+
+    private:
+      //! Element storage.
+      std::vector<T> m_items;
+      //! Index mask.
+      std::size_t m_mask;
+      //! Read position, written by the consumer.
+      std::atomic<std::size_t> m_head;
+      //! Write position, written by the producer.
+      std::atomic<std::size_t> m_tail;
+    };
+  }
+}
+
+#endif
@@ -27,10 +27,25 @@
 // Author: Tore Mo                                                          *
 //***************************************************************************
 
+// ISO C++ 98 headers.
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 #include <vector>
 
+// Local headers.
+#include "Georeference.hpp"
+#include "JitterBuffer.hpp"
+#include "JobScheduler.hpp"
+#include "MessageTrace.hpp"
+#include "PlannerWorker.hpp"
+#include "PlanRequestTracker.hpp"
+#include "TelemetryCodec.hpp"
+#include "TelemetryLog.hpp"
+
 namespace Maneuver
 {
   //! Insert short task description here.
@@ -42,6 +57,14 @@ namespace Maneuver
     using DUNE_NAMESPACES;
     using std::vector;
 
+    //! Identifier of the plan controlled by this task.
+    static const char* c_plan_id = "caravela_plan";
+    //! Extra time granted to an overrunning job before each replan (s).
+    static const double c_job_overrun_step = 60.0;
+    //! Navigation samples held while waiting for late ones.
+    static const unsigned c_nav_capacity = 16;
+    //! Position noise allowed on top of the speed limit (m).
+    static const double c_nav_gate_margin = 5.0;
 
     struct Arguments
     {
@@ -52,12 +75,66 @@ namespace Maneuver
       float horizontal_tolerance;
       std::string default_speed_units;
       std::string default_z_units;
+      std::string vehicle_type;
+      bool profiling;
+      float profile_min_z;
+      float profile_max_z;
+      float profile_pitch;
+      float profile_step;
+      float pc_timeout;
+      float pc_backoff;
+      unsigned pc_attempts;
 
       float waiting_time;
       float h;
       float s;
       float current_lat;
       float current_lon;
+      unsigned rows;
+      unsigned lookahead;
+      bool telemetry;
+      unsigned telemetry_segment;
+      vector<double> fence;
+      vector<double> keep_out;
+      std::string fence_mode;
+      float fence_margin;
+      bool avoidance;
+      float safety_radius;
+      float avoidance_horizon;
+      float contact_timeout;
+      bool compressed;
+      unsigned keyframe_interval;
+      unsigned frame_size;
+      float frame_period;
+      float refresh_period;
+      float kpi_period;
+      bool endurance;
+      float energy_reserve;
+      bool adaptive;
+      std::string detection_source;
+      float detection_threshold;
+      float hotspot_score;
+      unsigned refinement;
+      unsigned max_refinements;
+      bool georeference;
+      unsigned georef_batch;
+      bool depth_grid;
+      std::string depth_file;
+      float depth_cell;
+      float min_depth;
+      float clearance;
+      bool skip_known;
+      bool trace;
+      std::string trace_replay;
+      std::string schedule;
+      float transit_energy;
+      bool rejoin;
+      std::string formation_leader;
+      vector<double> formation_offset;
+      float formation_lead;
+      float formation_timeout;
+      float nav_latency;
+      float max_speed;
     };
 
 
@@ -77,10 +154,174 @@ namespace Maneuver
       IMC::DesiredPath m_d_path;
 
       bool m_caravela_control;
+      //! PlanControl requests waiting for a reply.
+      PlanRequestTracker m_requests;
+      //! Own navigation put back in timestamp order.
+      JitterBuffer<IMC::EstimatedState> m_nav;
+      //! Navigation sample being released.
+      IMC::EstimatedState m_nav_sample;
+      //! Rejects navigation jumps the vehicle cannot make.
+      KinematicGate m_gate;
+      //! Route planner thread.
+      PlannerWorker* m_planner;
+      //! Sequence number of the last setpoint taken from the planner.
+      unsigned m_setpoint_seq;
+      //! Route waypoint of the active reference.
+      size_t m_cursor;
+      //! Accumulated leg transition dead time.
+      double m_dead_time;
+      //! Longest leg transition dead time.
+      double m_dead_time_max;
+      //! Number of leg transitions.
+      unsigned m_transitions;
+      //! Accumulated time spent in consume(EstimatedState).
+      double m_consume_time;
+      //! Longest time spent in consume(EstimatedState).
+      double m_consume_time_max;
+      //! Number of EstimatedState messages consumed.
+      unsigned m_consumed;
+      //! Preallocated plan start request.
+      IMC::PlanControl m_pc_start;
+      //! Preallocated plan stop request.
+      IMC::PlanControl m_pc_stop;
+      //! Speed currently held by m_ref.
+      float m_ref_speed;
+      //! Z currently held by m_ref.
+      float m_ref_z;
+      //! Requests to retransmit, reused across polls.
+      vector<IMC::PlanControl> m_resend;
+      //! Requests that ran out of attempts, reused across polls.
+      vector<IMC::PlanControl> m_expired;
+      //! Binary telemetry recorder.
+      TelemetryWriter m_telemetry;
+      //! Operating area.
+      Geofence m_fence;
+      //! Geofence violations already reported.
+      unsigned m_fence_reported;
+      //! True while the planner steers clear of a contact.
+      bool m_avoiding;
+      //! True once the first route setpoint was dispatched.
+      bool m_route_started;
+      //! Compressed telemetry encoder.
+      TelemetryEncoder m_encoder;
+      //! Compressed telemetry waiting to be sent.
+      IMC::DevDataBinary m_frame;
+      //! Time the last compressed frame was sent.
+      double m_frame_time;
+      //! Records in the compressed stream.
+      unsigned long m_encoded;
+      //! Bytes in the compressed stream.
+      unsigned long m_encoded_bytes;
+      //! Encoder scratch buffer.
+      std::vector<uint8_t> m_scratch;
+      //! Time the reference was last dispatched.
+      double m_ref_time;
+      //! Sequence number of the last indicators taken from the planner.
+      unsigned m_kpi_seq;
+      //! Mission indicators report.
+      IMC::PlanStatistics m_stats;
+      //! Time the last indicators report was sent.
+      double m_stats_time;
+      //! True once the planner cut the route short to return to base.
+      bool m_returning;
+      //! Refined hotspot cells already reported.
+      unsigned m_refined_reported;
+      //! Payload sample georeferencing.
+      Georeferencer m_georef;
+      //! Sonar pings seen, used as the value of sonar samples.
+      unsigned m_pings;
+      //! Seabed depth map, owned by the planner while it runs.
+      DepthGrid m_depth;
+      //! Depth map file.
+      Path m_depth_path;
+      //! Depth related route changes already reported.
+      unsigned m_depth_reported;
+      //! Consumed and dispatched message recorder.
+      TraceWriter m_trace;
+      //! Replay output comparison.
+      TraceDiff m_diff;
+      //! True while the task is driven by a recorded trace.
+      bool m_replaying;
+      //! True while a recorded message is being fed to a consumer.
+      bool m_feeding;
+      //! Virtual time of the replay (s).
+      double m_vtime;
+      //! Day schedule.
+      JobScheduler m_jobs;
+      //! True when running a day schedule instead of the survey route.
+      bool m_scheduling;
+      //! True once the day schedule was planned.
+      bool m_jobs_planned;
+      //! True once own navigation was accepted.
+      bool m_has_nav;
+      //! Job whose plan was started.
+      Job m_job;
+      //! True while a job plan is running.
+      bool m_job_running;
+      //! True once the job plan was seen executing.
+      bool m_job_seen;
+      //! Time the running job is expected to end (s).
+      double m_job_end;
+      //! Latitude of the schedule frame origin (rad).
+      double m_jobs_lat;
+      //! Longitude of the schedule frame origin (rad).
+      double m_jobs_lon;
+      //! Last reported fuel level (%).
+      float m_fuel;
+      //! Formation leader system, when following one.
+      unsigned m_leader;
+      //! True when following a leader.
+      bool m_formation;
+      //! True while the leader is reported lost.
+      bool m_leader_lost;
+      //! Sum of leader pose delays (s).
+      double m_leader_delay;
+      //! Number of leader poses.
+      unsigned long m_leader_fixes;
 
       Task(const std::string& name, Tasks::Context& ctx):
         DUNE::Tasks::Task(name, ctx),
-        m_caravela_control(false)
+        m_caravela_control(false),
+        m_nav(c_nav_capacity),
+        m_planner(NULL),
+        m_setpoint_seq(0),
+        m_cursor(0),
+        m_dead_time(0.0),
+        m_dead_time_max(0.0),
+        m_transitions(0),
+        m_consume_time(0.0),
+        m_consume_time_max(0.0),
+        m_consumed(0),
+        m_fence_reported(0),
+        m_avoiding(false),
+        m_route_started(false),
+        m_frame_time(0.0),
+        m_encoded(0),
+        m_encoded_bytes(0),
+        m_ref_time(0.0),
+        m_kpi_seq(0),
+        m_stats_time(0.0),
+        m_returning(false),
+        m_refined_reported(0),
+        m_pings(0),
+        m_depth_reported(0),
+        m_replaying(false),
+        m_feeding(false),
+        m_vtime(0.0),
+        m_scheduling(false),
+        m_jobs_planned(false),
+        m_has_nav(false),
+        m_job_running(false),
+        m_job_seen(false),
+        m_job_end(0.0),
+        m_jobs_lat(0.0),
+        m_jobs_lon(0.0),
+        m_fuel(100.0),
+        m_leader(0),
+        m_formation(false),
+        m_leader_lost(false),
+        m_leader_delay(0.0),
+        m_leader_fixes(0)
       {
         param("Waiting time", m_args.waiting_time)
         .defaultValue("10.0")
@@ -97,6 +338,18 @@ namespace Maneuver
         .units(Units::Meter)
         .description("Latitudinal distance vehicle has to go to the next waypoint");
 
+        param("Number of Rows", m_args.rows)
+        .defaultValue("3")
+        .minimumValue("1")
+        .description("Number of rows of the lawnmower pattern");
+
+        param("Reference Lookahead", m_args.lookahead)
+        .defaultValue("2")
+        .description("Number of references computed ahead of time. When non zero"
+                     " the next reference is sent as soon as navigation shows"
+                     " the vehicle within horizontal tolerance, without waiting"
+                     " for FollowRefState. Zero waits for FollowRefState");
+
         param("Horizontal Tolerance", m_args.horizontal_tolerance)
         .defaultValue("15.0")
         .units(Units::Meter)
@@ -131,14 +384,345 @@ namespace Maneuver
         .units(Units::Meter)
         .description("Units to use for default z reference (one of 'DEPTH', 'ALTITUDE' or 'HEIGHT')");
 
+        param("Vehicle Type", m_args.vehicle_type)
+        .defaultValue("AUV")
+        .values("AUV,UAV")
+        .description("Vehicle type (AUV or UAV), default AUV");
+
+        param("Water Column Profiling", m_args.profiling)
+        .defaultValue("false")
+        .description("Move up and down between the profile limits along every"
+                     " leg, AUV with depth or altitude references only");
+
+        param("Profile Minimum Z", m_args.profile_min_z)
+        .defaultValue("1.0")
+        .units(Units::Meter)
+        .description("Shallowest z of the profile, in default z units");
+
+        param("Profile Maximum Z", m_args.profile_max_z)
+        .defaultValue("10.0")
+        .units(Units::Meter)
+        .description("Deepest z of the profile, in default z units");
+
+        param("Profile Pitch", m_args.profile_pitch)
+        .defaultValue("15.0")
+        .minimumValue("1.0")
+        .maximumValue("60.0")
+        .units(Units::Degree)
+        .description("Flight path angle while climbing or diving");
+
+        param("Profile Resolution", m_args.profile_step)
+        .defaultValue("2.0")
+        .minimumValue("0.5")
+        .units(Units::Meter)
+        .description("Z change between profile references. Each reference is"
+                     " only sent once the previous one is reached");
+
+        param("PlanControl Timeout", m_args.pc_timeout)
+        .defaultValue("2.0")
+        .minimumValue("0.1")
+        .units(Units::Second)
+        .description("Time to wait for a PlanControl reply before sending the request again");
+
+        param("PlanControl Backoff", m_args.pc_backoff)
+        .defaultValue("2.0")
+        .minimumValue("1.0")
+        .description("Factor applied to the reply timeout after each retry");
+
+        param("PlanControl Attempts", m_args.pc_attempts)
+        .defaultValue("4")
+        .minimumValue("1")
+        .description("Maximum number of times a PlanControl request is sent");
+
+        param("Telemetry Recording", m_args.telemetry)
+        .defaultValue("false")
+        .description("Record pose, references, FollowRefState and plan events"
+                     " to binary telemetry segments in the log directory");
+
+        param("Telemetry Segment Size", m_args.telemetry_segment)
+        .defaultValue("16")
+        .minimumValue("1")
+        .description("Size of each telemetry segment file, in MiB");
+
+        param("Geofence", m_args.fence)
+        .defaultValue("")
+        .description("Lease area polygon as a list of latitude, longitude"
+                     " pairs in degrees. Empty disables the lease check");
+
+        param("Keep-out Zones", m_args.keep_out)
+        .defaultValue("")
+        .description("Circular keep-out zones such as cages, as a list of"
+                     " latitude and longitude in degrees and radius in meters");
+
+        param("Geofence Mode", m_args.fence_mode)
+        .defaultValue("Clamp")
+        .values("Clamp,Reject")
+        .description("Move waypoints outside the geofence to the nearest allowed"
+                     " position, or skip them. Legs crossing a boundary are"
+                     " always skipped");
+
+        param("Geofence Margin", m_args.fence_margin)
+        .defaultValue("2.0")
+        .minimumValue("0.0")
+        .units(Units::Meter)
+        .description("Distance kept from boundaries when clamping waypoints");
+
+        param("Collision Avoidance", m_args.avoidance)
+        .defaultValue("false")
+        .description("Deflect the reference away from contacts reported by"
+                     " RemoteSensorInfo when they are on a collision course");
+
+        param("Safety Radius", m_args.safety_radius)
+        .defaultValue("20.0")
+        .minimumValue("1.0")
+        .units(Units::Meter)
+        .description("Minimum passing distance to contacts");
+
+        param("Avoidance Horizon", m_args.avoidance_horizon)
+        .defaultValue("60.0")
+        .minimumValue("1.0")
+        .units(Units::Second)
+        .description("How far ahead collisions with contacts are predicted");
+
+        param("Contact Timeout", m_args.contact_timeout)
+        .defaultValue("30.0")
+        .units(Units::Second)
+        .description("Time after which a contact without updates is forgotten");
+
+        param("Compressed Telemetry", m_args.compressed)
+        .defaultValue("false")
+        .description("Send pose, references and FollowRefState as delta"
+                     " compressed DevDataBinary frames for low bandwidth links");
+
+        param("Keyframe Interval", m_args.keyframe_interval)
+        .defaultValue("50")
+        .minimumValue("1")
+        .description("Compressed records of each type between absolute keyframes");
+
+        param("Frame Size", m_args.frame_size)
+        .defaultValue("200")
+        .minimumValue("16")
+        .units(Units::Byte)
+        .description("Compressed frame is sent once it reaches this size");
+
+        param("Frame Period", m_args.frame_period)
+        .defaultValue("1.0")
+        .units(Units::Second)
+        .description("Maximum time compressed telemetry waits before being sent");
+
+        param("Reference Refresh Period", m_args.refresh_period)
+        .defaultValue("1.0")
+        .units(Units::Second)
+        .description("Period at which the active reference is sent again");
+
+        param("KPI Period", m_args.kpi_period)
+        .defaultValue("10.0")
+        .units(Units::Second)
+        .description("Period at which mission indicators are reported, 0 to disable");
+
+        param("Endurance Check", m_args.endurance)
+        .defaultValue("false")
+        .description("Cut the route short and return to base when the predicted"
+                     " fuel left after the return falls below the reserve");
+
+        param("Energy Reserve", m_args.energy_reserve)
+        .defaultValue("20.0")
+        .units(Units::Percentage)
+        .minimumValue("0.0")
+        .maximumValue("100.0")
+        .description("Fuel level to keep on arrival back at base");
+
+        param("Adaptive Survey", m_args.adaptive)
+        .defaultValue("false")
+        .description("Insert fine resolution sub-patterns over cells where"
+                     " detections accumulate during the coarse sweep");
+
+        param("Detection Source", m_args.detection_source)
+        .defaultValue("Target")
+        .values("Target,Chlorophyll")
+        .description("Detection stream, Target reports or a chlorophyll threshold stand-in");
+
+        param("Detection Threshold", m_args.detection_threshold)
+        .defaultValue("5.0")
+        .description("Chlorophyll level above which samples score, by the excess");
+
+        param("Hotspot Score", m_args.hotspot_score)
+        .defaultValue("3.0")
+        .minimumValue("0.0")
+        .description("Accumulated cell score at which the cell is surveyed again");
+
+        param("Refinement Factor", m_args.refinement)
+        .defaultValue("4")
+        .minimumValue("2")
+        .description("Ratio between coarse and fine row spacing");
+
+        param("Maximum Refinements", m_args.max_refinements)
+        .defaultValue("10")
+        .description("Maximum number of cells surveyed again");
+
+        param("Georeferencing", m_args.georeference)
+        .defaultValue("false")
+        .description("Tag payload samples with the vehicle pose interpolated"
+                     " at their time and store them as columns");
+
+        param("Georeference Batch", m_args.georef_batch)
+        .defaultValue("4096")
+        .minimumValue("1")
+        .description("Georeferenced samples buffered before each write");
+
+        param("Depth Grid", m_args.depth_grid)
+        .defaultValue("false")
+        .description("Map seabed depth from depth and altitude, and use it"
+                     " to plan vertical references and avoid shallow water");
+
+        param("Depth Grid File", m_args.depth_file)
+        .defaultValue("depth.grid")
+        .description("Depth map file, relative to the log directory,"
+                     " loaded on start and saved on stop");
+
+        param("Depth Cell Size", m_args.depth_cell)
+        .defaultValue("2.0")
+        .units(Units::Meter)
+        .minimumValue("0.1")
+        .description("Depth map resolution, ignored when a map is loaded");
+
+        param("Minimum Water Depth", m_args.min_depth)
+        .defaultValue("1.0")
+        .units(Units::Meter)
+        .description("Legs crossing shallower mapped water are skipped");
+
+        param("Seabed Clearance", m_args.clearance)
+        .defaultValue("2.0")
+        .units(Units::Meter)
+        .description("Distance kept above the mapped seabed by depth references");
+
+        param("Skip Known Rows", m_args.skip_known)
+        .defaultValue("false")
+        .description("Leave out survey rows over already mapped seabed");
+
+        param("Trace Recording", m_args.trace)
+        .defaultValue("false")
+        .description("Record consumed and dispatched messages for replay");
+
+        param("Trace Replay", m_args.trace_replay)
+        .defaultValue("")
+        .description("Drive the task from a recorded trace in virtual time, as fast"
+                     " as possible, and compare its output with the recording."
+                     " Nothing is dispatched while replaying");
+
+        param("Job Schedule", m_args.schedule)
+        .defaultValue("")
+        .description("File, relative to the configuration directory, with one"
+                     " job per line: plan id, latitude and longitude (deg),"
+                     " duration (s), window open and close (HH:MM UTC) and"
+                     " energy (%). When set the listed plans are started at"
+                     " their scheduled time instead of the survey route");
+
+        param("Transit Energy", m_args.transit_energy)
+        .defaultValue("0.5")
+        .minimumValue("0.0")
+        .description("Energy used per kilometre sailed between jobs (%)");
+
+        param("Route Rejoin", m_args.rejoin)
+        .defaultValue("false")
+        .description("Track how far the route was covered and, after avoiding a"
+                     " contact, drifting off a survey leg or the plan being"
+                     " interrupted, go back there instead of skipping ahead");
+
+        param("Formation Leader", m_args.formation_leader)
+        .defaultValue("")
+        .description("System to follow in formation instead of running the"
+                     " survey route. The leader runs the route with rows spaced"
+                     " by the combined swath of the formation");
+
+        param("Formation Offset", m_args.formation_offset)
+        .defaultValue("0.0, 10.0")
+        .size(2)
+        .units(Units::Meter)
+        .description("Formation slot ahead of and to the right of the leader,"
+                     " in the leader body frame");
+
+        param("Formation Lookahead", m_args.formation_lead)
+        .defaultValue("10.0")
+        .minimumValue("0.0")
+        .units(Units::Second)
+        .description("Time ahead of the slot the reference is placed");
+
+        param("Formation Timeout", m_args.formation_timeout)
+        .defaultValue("10.0")
+        .minimumValue("1.0")
+        .units(Units::Second)
+        .description("Longest leader prediction, the vehicle holds its last"
+                     " reference when the leader is silent for longer");
+
+        param("Navigation Latency", m_args.nav_latency)
+        .defaultValue("0.0")
+        .minimumValue("0.0")
+        .units(Units::Second)
+        .description("Longest time own navigation is held to put samples that"
+                     " arrive out of order back in sequence. Duplicate and late"
+                     " samples are dropped regardless");
+
+        param("Maximum Vehicle Speed", m_args.max_speed)
+        .defaultValue("0.0")
+        .minimumValue("0.0")
+        .units(Units::MeterPerSecond)
+        .description("Navigation samples implying a faster move than this are"
+                     " discarded. Zero disables the check");
+
         bind<IMC::FollowRefState>(this);
         bind<IMC::EstimatedState>(this);
+        bind<IMC::RemoteSensorInfo>(this);
+        bind<IMC::FuelLevel>(this);
+        bind<IMC::Target>(this);
+        bind<IMC::Chlorophyll>(this);
+        bind<IMC::Temperature>(this);
+        bind<IMC::DissolvedOxygen>(this);
+        bind<IMC::Conductivity>(this);
+        bind<IMC::SonarData>(this);
+        bind<IMC::PlanControl>(this);
+        bind<IMC::PlanControlState>(this);
+        bind<IMC::Abort>(this);
       }
 
       //! Update internal state with new parameter values.
       void
       onUpdateParameters(void)
       {
+        m_requests.setRetryPolicy(m_args.pc_timeout, m_args.pc_backoff, m_args.pc_attempts);
+        m_nav.setLatency(m_args.nav_latency);
+        m_gate.setup(m_args.max_speed, c_nav_gate_margin);
+        m_encoder.setKeyframeInterval(m_args.keyframe_interval);
+
+        // Initial values are picked up when resources are acquired.
+        if (m_planner == NULL)
+          return;
+
+        if (paramChanged(m_args.loitering_radius))
+          m_ref.radius = m_args.loitering_radius;
+
+        bool geometry = paramChanged(m_args.h) || paramChanged(m_args.s)
+        || paramChanged(m_args.rows) || paramChanged(m_args.default_z);
+        bool speed = paramChanged(m_args.default_speed);
+        if (!geometry && !speed)
+          return;
+
+        if (speed)
+          updateSpeed();
+
+        PlannerEvent ev;
+        ev.type = PlannerEvent::EV_PARAMS;
+        ev.rows = m_args.rows;
+        ev.h = m_args.h;
+        ev.s = m_args.s;
+        ev.z = m_args.default_z;
+        ev.speed = m_args.default_speed;
+        ev.geometry = geometry;
+
+        if (m_planner->post(ev))
+          inf("route settings updated%s", geometry ? ", regenerating remaining legs" : "");
+        else
+          war("route settings update dropped, planner busy");
       }
 
       //! Reserve entity identifiers.
@@ -157,19 +741,183 @@ namespace Maneuver
       void
       onResourceAcquisition(void)
       {
+        PlannerConfig cfg;
+        cfg.rows = m_args.rows;
+        cfg.h = m_args.h;
+        cfg.s = m_args.s;
+        cfg.z = m_args.default_z;
+        cfg.speed = m_args.default_speed;
+        cfg.horizontal_tolerance = m_args.horizontal_tolerance;
+        cfg.lookahead = m_args.lookahead;
+        cfg.fence = &m_fence;
+        cfg.fence_clamp = m_args.fence_mode == "Clamp";
+        cfg.fence_margin = m_args.fence_margin;
+        cfg.avoidance = m_args.avoidance;
+        cfg.safety_radius = m_args.safety_radius;
+        cfg.avoidance_horizon = m_args.avoidance_horizon;
+        cfg.contact_timeout = m_args.contact_timeout;
+        cfg.endurance = m_args.endurance;
+        cfg.energy_reserve = m_args.energy_reserve;
+        cfg.adaptive = m_args.adaptive;
+        cfg.hotspot_score = m_args.hotspot_score;
+        cfg.refinement = m_args.refinement;
+        cfg.max_refinements = m_args.max_refinements;
+        cfg.depth = m_args.depth_grid ? &m_depth : NULL;
+        cfg.z_depth = m_args.default_z_units == "DEPTH";
+        cfg.min_depth = m_args.min_depth;
+        cfg.clearance = m_args.clearance;
+        cfg.skip_known = m_args.skip_known;
+        cfg.profiling = m_args.profiling;
+        cfg.profile_min_z = m_args.profile_min_z;
+        cfg.profile_max_z = m_args.profile_max_z;
+        cfg.profile_pitch = Angles::radians(m_args.profile_pitch);
+        cfg.profile_step = m_args.profile_step;
+        cfg.vertical_tolerance = m_args.vertical_tolerance;
+        cfg.rejoin = m_args.rejoin;
+        cfg.formation = false;
+        cfg.formation_forward = m_args.formation_offset[0];
+        cfg.formation_starboard = m_args.formation_offset[1];
+        cfg.formation_lead = m_args.formation_lead;
+        cfg.formation_timeout = m_args.formation_timeout;
+
+        if (!m_args.formation_leader.empty())
+        {
+          try
+          {
+            m_leader = m_ctx.resolver.resolve(m_args.formation_leader);
+            cfg.formation = true;
+          }
+          catch (std::exception& e)
+          {
+            err("formation leader %s unknown: %s", m_args.formation_leader.c_str(), e.what());
+          }
+        }
+
+        m_formation = cfg.formation;
+
+        if (cfg.profiling && (m_args.vehicle_type != "AUV" || m_args.default_z_units == "HEIGHT"))
+        {
+          war("water column profiling needs an AUV with depth or altitude references, disabling it");
+          cfg.profiling = false;
+        }
+
+        if (m_args.depth_grid)
+          loadDepthGrid();
+
+        m_scheduling = !m_args.schedule.empty() && loadSchedule();
+        m_jobs_planned = false;
+        cfg.scheduling = m_scheduling;
+
+        vector<double> fence(m_args.fence.size());
+        for (size_t i = 0; i < fence.size(); ++i)
+          fence[i] = Angles::radians(m_args.fence[i]);
+
+        vector<double> keep_out(m_args.keep_out);
+        for (size_t i = 0; i < keep_out.size(); ++i)
+        {
+          if (i % 3 != 2)
+            keep_out[i] = Angles::radians(keep_out[i]);
+        }
+
+        if (!fence.empty() && (fence.size() % 2 != 0 || fence.size() < 6))
+          war("geofence needs at least three latitude, longitude pairs, ignoring it");
+        if (keep_out.size() % 3 != 0)
+          war("keep-out zones need latitude, longitude and radius, ignoring the last one");
+
+        m_fence.setup(fence.size() % 2 == 0 ? fence : vector<double>(), keep_out);
+
+        m_planner = new PlannerWorker(cfg);
+
+        // Replays run the planner synchronously to be deterministic.
+        m_replaying = !m_args.trace_replay.empty();
+        if (!m_replaying)
+          m_planner->start();
+
+        if (m_args.trace && !m_replaying)
+        {
+          Path dir = m_ctx.dir_log / "trace";
+          dir.create();
+          Path file = dir / String::str("%.0f.trace", Clock::getSinceEpoch());
+
+          try
+          {
+            m_trace.open(file.str(), now());
+          }
+          catch (std::exception& e)
+          {
+            war("trace recording disabled: %s", e.what());
+          }
+        }
+
+        if (m_args.telemetry)
+        {
+          Path dir = m_ctx.dir_log / "telemetry";
+          dir.create();
+
+          try
+          {
+            m_telemetry.open(dir.str(), String::str("%.0f", Clock::getSinceEpoch()),
+                             m_args.telemetry_segment << 20);
+          }
+          catch (std::exception& e)
+          {
+            war("telemetry recording disabled: %s", e.what());
+          }
+        }
 
+        if (m_args.georeference)
+        {
+          Path dir = m_ctx.dir_log / "georef" / String::str("%.0f", Clock::getSinceEpoch());
+          dir.create();
+
+          try
+          {
+            m_georef.output().open(dir.str(), m_args.georef_batch);
+          }
+          catch (std::exception& e)
+          {
+            war("georeferencing disabled: %s", e.what());
+          }
+        }
       }
 
       //! Initialize resources.
       void
       onResourceInitialization(void)
       {
+        initPlanRequests();
+        initReference();
+
+        m_stats.plan_id = c_plan_id;
+        m_stats.type = IMC::PlanStatistics::TP_INPLAN;
       }
 
       //! Release resources.
       void
       onResourceRelease(void)
       {
+        if (!m_telemetry.close())
+          err("telemetry segments could not be trimmed to their records");
+
+        m_trace.close();
+
+        if (m_georef.output().isOpen())
+        {
+          m_georef.output().close();
+          inf("georeferenced %lu samples, %lu dropped",
+              m_georef.getTagged(), m_georef.getDropped());
+        }
+
+        if (m_planner != NULL)
+        {
+          if (!m_replaying)
+            m_planner->stopAndJoin();
+          delete m_planner;
+          m_planner = NULL;
+        }
+
+        if (m_args.depth_grid)
+          saveDepthGrid();
       }
 
       void updateSpeed(void)
@@ -180,115 +928,1186 @@ namespace Maneuver
 
       void consume(const IMC::EstimatedState* msg)
       {
-        float pi = 3.14159265359;
+        if (!admit(msg))
+          return;
+
+        if (m_formation && msg->getSource() == m_leader)
+        {
+          postLeader(msg);
+          return;
+        }
 
         if (msg->getSource() != getSystemId())
         return;
 
-        m_estate = *msg;
-        m_estate.lon = msg -> lon;
-        m_estate.lat = msg -> lat;
+        double t0 = Clock::get();
+
+        m_nav.push(msg->getTimeStamp(), *msg, now());
+        releaseNavigation();
+
+        double elapsed = Clock::get() - t0;
+        m_consume_time += elapsed;
+        m_consume_time_max = std::max(m_consume_time_max, elapsed);
+        ++m_consumed;
+      }
+
+      //! Hand over own navigation samples that are due, in the order
+      //! they were taken.
+      void
+      releaseNavigation(void)
+      {
+        while (m_nav.pop(now(), m_nav_sample))
+          onNavigation(m_nav_sample);
+      }
+
+      //! Handle an own navigation sample.
+      //! @param[in] msg navigation, in timestamp order.
+      void
+      onNavigation(const IMC::EstimatedState& msg)
+      {
+        float pi = 3.14159265359;
+
         //calculate position according to WGS84
-        m_estate.lat = m_estate.lat + (m_estate.x * 2 * pi)/40075000;
-	      m_estate.lon = m_estate.lon + (m_estate.y * 2 * pi)/(40075000 * cos(m_estate.lat));
+        double lat = msg.lat + (msg.x * 2 * pi)/40075000;
+        double lon = msg.lon + (msg.y * 2 * pi)/(40075000 * cos(lat));
+
+        if (!m_gate.check(msg.getTimeStamp(), lat, lon))
+          return;
+
+        m_estate = msg;
+        m_estate.lat = lat;
+        m_estate.lon = lon;
+        m_has_nav = true;
+
+        if (m_args.compressed && m_encoded == 0)
+          m_encoder.setOrigin(msg.lat, msg.lon);
+
+        PlannerEvent ev;
+        ev.type = PlannerEvent::EV_POSE;
+        ev.pose.time = now();
+        ev.pose.lat = m_estate.lat;
+        ev.pose.lon = m_estate.lon;
+        ev.pose.depth = m_estate.depth;
+        ev.pose.psi = m_estate.psi;
+        ev.pose.speed = std::sqrt(m_estate.vx * m_estate.vx + m_estate.vy * m_estate.vy);
+        ev.pose.vx = m_estate.vx;
+        ev.pose.vy = m_estate.vy;
+        ev.pose.u = m_estate.u;
+        ev.pose.alt = m_estate.alt;
+        ev.pose.r = m_estate.r;
+        m_planner->post(ev);
+
+        if (m_georef.output().isOpen())
+        {
+          PoseFix fix;
+          fix.time = msg.getTimeStamp();
+          fix.lat = m_estate.lat;
+          fix.lon = m_estate.lon;
+          fix.depth = m_estate.depth;
+          fix.psi = m_estate.psi;
+          m_georef.addPose(fix);
+        }
+
+        if (isRecording())
+        {
+          TelemetryRecord rec = makeRecord(TelemetryRecord::REC_POSE);
+          rec.lat = ev.pose.lat;
+          rec.lon = ev.pose.lon;
+          rec.z = ev.pose.depth;
+          rec.psi = ev.pose.psi;
+          rec.speed = ev.pose.speed;
+          record(rec);
+        }
+      }
+
+      //! Pass a leader pose to the planner, stamped with the time it
+      //! was taken so the planner can predict across the link delay.
+      //! @param[in] msg leader navigation.
+      void
+      postLeader(const IMC::EstimatedState* msg)
+      {
+        // Clocks are synchronised by GNSS. Replays have no link delay.
+        double delay = m_replaying ? 0.0 : Clock::getSinceEpoch() - msg->getTimeStamp();
+        if (delay > m_args.formation_timeout)
+          return;
+
+        delay = std::max(0.0, delay);
+        m_leader_delay += delay;
+        ++m_leader_fixes;
+
+        PlannerEvent ev;
+        ev.type = PlannerEvent::EV_LEADER;
+        ev.pose.time = now() - delay;
+        ev.pose.lat = msg->lat;
+        ev.pose.lon = msg->lon;
+        WGS84::displace(msg->x, msg->y, &ev.pose.lat, &ev.pose.lon);
+        ev.pose.depth = msg->depth;
+        ev.pose.psi = msg->psi;
+        ev.pose.speed = std::sqrt(msg->vx * msg->vx + msg->vy * msg->vy);
+        ev.pose.vx = msg->vx;
+        ev.pose.vy = msg->vy;
+        ev.pose.u = msg->u;
+        ev.pose.alt = msg->alt;
+        ev.pose.r = msg->r;
+        m_planner->post(ev);
       }
 
       void consume(const IMC::FollowRefState* msg)
       {
-  /*      if(msg->state == IMC::FollowRefState::FR_WAIT)
-          war("Hello");
-  */      //first reference position of estimated position
-        m_ref.flags = Reference::FLAG_LOCATION;
-        m_ref.lon = m_estate.lon;
-        m_ref.lat = m_estate.lat;
-        m_ref.radius = m_args.loitering_radius;
+        if (!admit(msg))
+          return;
 
-        //m_ref.speed = m_args.default_speed;
+        PlannerEvent ev;
+        ev.type = PlannerEvent::EV_FOLLOW_REF;
+        ev.pose.time = now();
+        ev.proximity = msg->proximity;
 
-        vector<double> lon_wp{m_args.h, m_args.h, m_estate.lon, m_estate.lon, m_args.h, m_args.h};
-        vector<double> lat_wp{m_estate.lat, m_estate.lat + m_args.s, m_estate.lat + m_args.s, m_estate.lat + 2*m_args.s, m_estate.lat + 2*m_args.s, m_estate.lat + 3*m_args.s};
+        ev.ref_lat = 0.0;
+        ev.ref_lon = 0.0;
 
-        for (double i = 0 ; i < 6 ; i++)
+        const IMC::Reference* ref = msg->reference.get();
+        ev.has_ref = ref != NULL;
+        if (ev.has_ref)
         {
-          if (msg->proximity == IMC::FollowRefState::PROX_XY_NEAR)
-          {
-            m_ref.lon = lon_wp[i];
-            m_ref.lat = lat_wp[i];
-          }
+          ev.ref_lat = ref->lat;
+          ev.ref_lon = ref->lon;
         }
 
-        dispatch(m_ref);
+        m_planner->post(ev);
+
+        if (isRecording())
+        {
+          TelemetryRecord rec = makeRecord(TelemetryRecord::REC_FOLLOW_REF);
+          rec.lat = ev.ref_lat;
+          rec.lon = ev.ref_lon;
+          rec.state = msg->state;
+          rec.proximity = msg->proximity;
+          record(rec);
+        }
       }
 
       void
-      abortMission(void)
+      consume(const IMC::FuelLevel* msg)
       {
-        inf("Abort Task...");
-        IMC::PlanControl abortMission;
-        abortMission.type = IMC::PlanControl::PC_REQUEST;
-        abortMission.op = IMC::PlanControl::PC_STOP;
-        abortMission.plan_id = "caravela_plan";
-        dispatch(abortMission);
+        if (!admit(msg))
+          return;
+
+        m_fuel = msg->value;
+
+        PlannerEvent ev;
+        ev.type = PlannerEvent::EV_FUEL;
+        ev.pose.time = now();
+        ev.fuel = msg->value;
+        m_planner->post(ev);
       }
 
       void
-      onDeactivation(void)
+      consume(const IMC::Target* msg)
       {
-        m_caravela_control = m_plan_control_state.plan_id == "caravela_plan"
-        && m_plan_control_state.state == IMC::PlanControlState::PCS_EXECUTING;
+        if (!admit(msg))
+          return;
 
-        if (m_caravela_control && !isActive())
-        {
-          abortMission();
-        }
+        if (!m_args.adaptive || m_args.detection_source != "Target")
+          return;
+
+        postDetection(msg->lat, msg->lon, 1.0);
       }
 
-      //! Main loop.
       void
-      onMain(void)
+      consume(const IMC::Chlorophyll* msg)
       {
-        DUNE::Time::Delay::waitNsec(m_args.waiting_time * 1000000000.0);
-        war("Starting followref");
+        if (!admit(msg))
+          return;
 
-        IMC::PlanControl pc;
-        pc.plan_id = "caravela_plan";
-        pc.op = IMC::PlanControl::PC_START; //operation
-        pc.type = IMC::PlanControl::PC_REQUEST; //type
-        //pc.flags = IMC::PlanControl::FLG_IGNORE_ERRORS;
-        pc.request_id = 0;
+        // Readings of other systems were not taken at our position.
+        if (msg->getSource() != getSystemId())
+          return;
 
-        IMC::FollowReference man;
-        man.control_src = 0xFFFF;
-        man.control_ent = 0xFF;
-        man.loiter_radius = 7.5;
-        man.timeout = 30.0;
-        man.altitude_interval = 2.0; //
+        georeference(msg, msg->value);
 
-        IMC::PlanManeuver pm;
-        pm.maneuver_id = "followref";
-        pm.data.set(man);
+        if (!m_args.adaptive || m_args.detection_source != "Chlorophyll")
+          return;
 
-        IMC::PlanSpecification ps;
-        ps.plan_id = pc.plan_id;
-        ps.start_man_id = pm.maneuver_id;
-        ps.maneuvers.push_back(pm);
-        pc.arg.set(ps);
-        pc.flags = 0;
-        pc.setDestination(m_ctx.resolver.id());
+        // Stand-in detector, scores samples by how far they exceed the threshold.
+        if (msg->value > m_args.detection_threshold)
+          postDetection(m_estate.lat, m_estate.lon, msg->value - m_args.detection_threshold);
+      }
 
-        dispatch(pc);
+      void
+      consume(const IMC::Temperature* msg)
+      {
+        if (msg->getSource() != getSystemId())
+          return;
 
-        DUNE::Time::Delay::waitNsec(1000000000.0);
+        georeference(msg, msg->value);
+      }
 
-        updateSpeed();
+      void
+      consume(const IMC::DissolvedOxygen* msg)
+      {
+        if (msg->getSource() != getSystemId())
+          return;
 
-        while (!stopping())
-        {
-          onDeactivation();
-          dispatch(m_ref);
-        }
+        georeference(msg, msg->value);
+      }
 
+      void
+      consume(const IMC::Conductivity* msg)
+      {
+        if (msg->getSource() != getSystemId())
+          return;
+
+        georeference(msg, msg->value);
+      }
+
+      void
+      consume(const IMC::SonarData* msg)
+      {
+        if (msg->getSource() != getSystemId())
+          return;
+
+        // Pings are tagged by sequence number, to be joined with the raw log.
+        georeference(msg, m_pings++);
+      }
+
+      //! Queue a payload sample for georeferencing.
+      //! @param[in] msg payload message.
+      //! @param[in] value sample value.
+      void
+      georeference(const IMC::Message* msg, float value)
+      {
+        // Payload streams are not traced, they do not steer the vehicle.
+        if (m_georef.output().isOpen() && !m_replaying)
+          m_georef.addSample(msg->getTimeStamp(), msg->getId(), msg->getSourceEntity(), value);
+      }
+
+      //! Queue a detection for the planner.
+      //! @param[in] lat latitude (rad).
+      //! @param[in] lon longitude (rad).
+      //! @param[in] score detection score.
+      void
+      postDetection(double lat, double lon, float score)
+      {
+        PlannerEvent ev;
+        ev.type = PlannerEvent::EV_DETECTION;
+        ev.pose.time = now();
+        ev.pose.lat = lat;
+        ev.pose.lon = lon;
+        ev.score = score;
+        m_planner->post(ev);
+      }
+
+      void
+      consume(const IMC::Abort* msg)
+      {
+        // Only traced, the plan supervisor stops the plan.
+        if (admit(msg))
+          war("abort received");
+      }
+
+      void
+      consume(const IMC::RemoteSensorInfo* msg)
+      {
+        if (!admit(msg))
+          return;
+
+        if (!m_args.avoidance)
+          return;
+
+        // FNV-1a, contacts are keyed by a short numeric id.
+        uint32_t id = 2166136261u;
+        for (size_t i = 0; i < msg->id.size(); ++i)
+          id = (id ^ (uint8_t)msg->id[i]) * 16777619u;
 
+        PlannerEvent ev;
+        ev.type = PlannerEvent::EV_CONTACT;
+        ev.contact = id;
+        ev.pose.time = now();
+        ev.pose.lat = msg->lat;
+        ev.pose.lon = msg->lon;
+        ev.pose.depth = 0.0;
+        ev.pose.psi = msg->heading;
+        // RemoteSensorInfo has no speed, the planner differences fixes.
+        ev.pose.speed = -1.0;
+        m_planner->post(ev);
+      }
+
+      //! Create an empty telemetry record stamped with the current time.
+      //! @param[in] type record type.
+      //! @return record.
+      static TelemetryRecord
+      makeRecord(uint8_t type)
+      {
+        TelemetryRecord rec;
+        std::memset(&rec, 0, sizeof(rec));
+        rec.time = Clock::getSinceEpoch();
+        rec.type = type;
+        return rec;
+      }
+
+      //! Append a record to the telemetry log.
+      //! @param[in] rec record.
+      void
+      record(const TelemetryRecord& rec)
+      {
+        if (m_telemetry.isOpen() && !m_telemetry.append(rec))
+          war("telemetry recording stopped after %llu records",
+              (unsigned long long)m_telemetry.getCount());
+
+        if (!m_args.compressed || rec.type > TelemetryRecord::REC_FOLLOW_REF)
+          return;
+
+        m_scratch.clear();
+        if (m_frame.value.empty())
+          m_encoder.beginFrame(m_scratch);
+
+        m_encoder.encode(rec, m_scratch);
+        m_frame.value.insert(m_frame.value.end(), m_scratch.begin(), m_scratch.end());
+        m_encoded_bytes += m_scratch.size();
+        ++m_encoded;
+
+        if (m_frame.value.size() >= m_args.frame_size)
+          sendFrame();
+      }
+
+      //! Check if telemetry records are consumed by anything.
+      bool
+      isRecording(void) const
+      {
+        return m_telemetry.isOpen() || m_args.compressed;
+      }
+
+      //! Send pending compressed telemetry.
+      void
+      sendFrame(void)
+      {
+        m_frame_time = now();
+        if (m_frame.value.empty())
+          return;
+
+        send(m_frame);
+        m_frame.value.clear();
+        spew("compressed telemetry: %lu records, %.1f bytes per record",
+             m_encoded, (double)m_encoded_bytes / m_encoded);
+      }
+
+      //! Report the latest mission indicators.
+      void
+      sendStatistics(void)
+      {
+        m_stats_time = now();
+
+        KpiSnapshot kpi;
+        if (!m_planner->pollKpi(m_kpi_seq, kpi))
+          return;
+
+        m_stats.durations = String::str("Elapsed=%.0f,Row=%.0f,Transit=%.0f,Loiter=%.0f,ETA=%.0f",
+                                        kpi.elapsed, kpi.row_time, kpi.transit_time,
+                                        kpi.loiter_time, kpi.eta);
+        m_stats.distances = String::str("Remaining=%.1f,Area=%.0f,AreaRate=%.0f,"
+                                        "CurrentN=%.2f,CurrentE=%.2f",
+                                        kpi.remaining, kpi.area, kpi.area_rate,
+                                        kpi.current_x, kpi.current_y);
+        if (kpi.formation)
+        {
+          m_stats.distances += String::str(",SpacingRms=%.1f,SpacingMax=%.1f",
+                                           kpi.spacing_rms, kpi.spacing_max);
+          m_stats.durations += String::str(",LinkDelay=%.2f", m_leader_fixes ?
+                                           m_leader_delay / m_leader_fixes : 0.0);
+        }
+        if (kpi.has_energy)
+          m_stats.fuel = String::str("Margin=%.1f", kpi.energy_margin);
+
+        send(m_stats);
+
+        debug("waypoint %u: %.0f m2/h, %.0f m left, eta %.0f s",
+              kpi.index, kpi.area_rate, kpi.remaining, kpi.eta);
+      }
+
+      //! Convert units name to IMC z units.
+      //! @param[in] units units name.
+      //! @return z units.
+      static uint8_t
+      getZUnits(const std::string& units)
+      {
+        if (units == "ALTITUDE")
+          return IMC::Z_ALTITUDE;
+        if (units == "HEIGHT")
+          return IMC::Z_HEIGHT;
+        return IMC::Z_DEPTH;
+      }
+
+      //! Build the PlanControl requests once, so that starting and
+      //! stopping the plan only copies them.
+      void
+      initPlanRequests(void)
+      {
+        m_pc_start.plan_id = c_plan_id;
+        m_pc_start.op = IMC::PlanControl::PC_START; //operation
+        m_pc_start.type = IMC::PlanControl::PC_REQUEST; //type
+        //m_pc_start.flags = IMC::PlanControl::FLG_IGNORE_ERRORS;
+
+        IMC::FollowReference man;
+        man.control_src = 0xFFFF;
+        man.control_ent = 0xFF;
+        man.loiter_radius = 7.5;
+        man.timeout = 30.0;
+        man.altitude_interval = 2.0; //
+
+        IMC::PlanManeuver pm;
+        pm.maneuver_id = "followref";
+        pm.data.set(man);
+
+        IMC::PlanSpecification ps;
+        ps.plan_id = m_pc_start.plan_id;
+        ps.start_man_id = pm.maneuver_id;
+        ps.maneuvers.push_back(pm);
+        m_pc_start.arg.set(ps);
+        m_pc_start.flags = 0;
+        m_pc_start.setDestination(m_ctx.resolver.id());
+
+        m_pc_stop.type = IMC::PlanControl::PC_REQUEST;
+        m_pc_stop.op = IMC::PlanControl::PC_STOP;
+        m_pc_stop.plan_id = c_plan_id;
+        m_pc_stop.setDestination(m_ctx.resolver.id());
+      }
+
+      //! Prepare the Reference template. Leg transitions then only
+      //! patch position, and speed or z when they change.
+      void
+      initReference(void)
+      {
+        m_ref.flags = Reference::FLAG_LOCATION | Reference::FLAG_SPEED | Reference::FLAG_Z;
+        m_ref.radius = m_args.loitering_radius;
+        setReferenceSpeed(m_args.default_speed);
+        setReferenceZ(m_args.default_z);
+      }
+
+      //! Set speed of the Reference template.
+      //! @param[in] value speed (m/s).
+      void
+      setReferenceSpeed(float value)
+      {
+        IMC::DesiredSpeed speed;
+        speed.value = value;
+        speed.speed_units = IMC::SUNITS_METERS_PS;
+        m_ref.speed.set(speed);
+        m_ref_speed = value;
+      }
+
+      //! Set z of the Reference template.
+      //! @param[in] value z reference (m).
+      void
+      setReferenceZ(float value)
+      {
+        IMC::DesiredZ z;
+        z.value = value;
+        z.z_units = getZUnits(m_args.default_z_units);
+        m_ref.z.set(z);
+        m_ref_z = value;
+      }
+
+      //! Report new geofence violations.
+      void
+      checkFence(void)
+      {
+        unsigned clamped = m_planner->getFenceClamped();
+        unsigned rejected = m_planner->getFenceRejected();
+        if (clamped + rejected == m_fence_reported)
+          return;
+
+        m_fence_reported = clamped + rejected;
+        war("geofence: %u waypoints clamped, %u rejected", clamped, rejected);
+      }
+
+      //! Load the depth map, starting empty if there is none yet.
+      void
+      loadDepthGrid(void)
+      {
+        m_depth_path = m_ctx.dir_log / m_args.depth_file;
+        m_depth.clear();
+        m_depth.setCellSize(m_args.depth_cell);
+
+        if (!m_depth_path.exists())
+          return;
+
+        try
+        {
+          m_depth.load(m_depth_path.str());
+          inf("depth map: %lu tiles of %.1f m cells",
+              (unsigned long)m_depth.getTiles(), m_depth.getCellSize());
+        }
+        catch (std::exception& e)
+        {
+          war("depth map not loaded: %s", e.what());
+          m_depth.clear();
+          m_depth.setCellSize(m_args.depth_cell);
+        }
+      }
+
+      //! Parse a time of day.
+      //! @param[in] text time as HH:MM.
+      //! @param[out] value seconds since midnight.
+      //! @return false if the text is not a time of day.
+      static bool
+      parseTimeOfDay(const std::string& text, double& value)
+      {
+        unsigned h, m;
+        if (std::sscanf(text.c_str(), "%u:%u", &h, &m) != 2 || h > 24 || m > 59)
+          return false;
+
+        value = h * 3600.0 + m * 60.0;
+        return true;
+      }
+
+      //! Read the day schedule. Windows are today's, in task time.
+      //! @return true if at least one job was read.
+      bool
+      loadSchedule(void)
+      {
+        Path path = m_ctx.dir_cfg / m_args.schedule;
+        std::ifstream ifs(path.c_str());
+        if (!ifs)
+        {
+          err("job schedule %s not found", path.c_str());
+          return false;
+        }
+
+        m_jobs.clear();
+        m_jobs.setup(m_args.default_speed, m_args.transit_energy / 1000.0);
+
+        // Midnight UTC of the current day, in task time.
+        double epoch = Clock::getSinceEpoch();
+        double midnight = std::floor(epoch / 86400.0) * 86400.0 - (epoch - now());
+
+        std::string line;
+        unsigned count = 0;
+        unsigned number = 0;
+
+        while (std::getline(ifs, line))
+        {
+          ++number;
+          if (line.empty() || line[0] == '#')
+            continue;
+
+          std::istringstream iss(line);
+          std::string open, close;
+          double lat, lon;
+          Job job;
+
+          if (!(iss >> job.plan_id >> lat >> lon >> job.duration >> open >> close >> job.energy)
+              || !parseTimeOfDay(open, job.open) || !parseTimeOfDay(close, job.close))
+          {
+            war("job schedule line %u ignored", number);
+            continue;
+          }
+
+          // The first job anchors the schedule frame.
+          if (count == 0)
+          {
+            m_jobs_lat = Angles::radians(lat);
+            m_jobs_lon = Angles::radians(lon);
+          }
+
+          WGS84::displacement(m_jobs_lat, m_jobs_lon, 0.0,
+                              Angles::radians(lat), Angles::radians(lon), 0.0,
+                              &job.x, &job.y);
+
+          // Windows may run past midnight.
+          if (job.close < job.open)
+            job.close += 86400.0;
+
+          job.open += midnight;
+          job.close += midnight;
+          m_jobs.add(job);
+          ++count;
+        }
+
+        inf("job schedule: %u jobs", count);
+        return count > 0;
+      }
+
+      //! Energy the schedule may still use (%).
+      double
+      getJobEnergy(void) const
+      {
+        return std::max(0.0, (double)m_fuel - m_args.energy_reserve);
+      }
+
+      //! Order the jobs from the vehicle position.
+      void
+      planJobs(void)
+      {
+        double x, y;
+        WGS84::displacement(m_jobs_lat, m_jobs_lon, 0.0, m_estate.lat, m_estate.lon, 0.0,
+                            &x, &y);
+
+        double begin = Clock::get();
+        m_jobs.plan(now(), x, y, getJobEnergy());
+
+        inf("job schedule: %u scheduled, %u without a slot, %.1f km transit in %.1f ms",
+            (unsigned)m_jobs.size(), (unsigned)m_jobs.getUnscheduled(),
+            m_jobs.getDistance() / 1000.0, (Clock::get() - begin) * 1000.0);
+      }
+
+      //! Start job plans on time and follow their execution.
+      void
+      checkSchedule(void)
+      {
+        // Jobs are ordered from the vehicle position.
+        if (!m_jobs_planned)
+        {
+          if (!m_has_nav)
+            return;
+
+          planJobs();
+          m_jobs_planned = true;
+        }
+
+        double time = now();
+
+        if (m_job_running)
+        {
+          bool executing = m_plan_control_state.plan_id == m_job.plan_id
+          && m_plan_control_state.state == IMC::PlanControlState::PCS_EXECUTING;
+
+          if (executing)
+          {
+            m_job_seen = true;
+          }
+          else if (m_job_seen)
+          {
+            inf("job %s done", m_job.plan_id.c_str());
+            m_job_running = false;
+            m_jobs.replan(time, m_job.x, m_job.y, getJobEnergy());
+            return;
+          }
+
+          if (time < m_job_end)
+            return;
+
+          if (!m_job_seen)
+          {
+            err("job %s did not start", m_job.plan_id.c_str());
+            m_job_running = false;
+            m_jobs.replan(time, m_job.x, m_job.y, getJobEnergy());
+            return;
+          }
+
+          // Keep pushing the remaining jobs back until the plan ends.
+          size_t before = m_jobs.size();
+          m_job_end = time + c_job_overrun_step;
+          m_jobs.replan(m_job_end, m_job.x, m_job.y, getJobEnergy());
+          war("job %s overrunning, %u jobs lost their slot", m_job.plan_id.c_str(),
+              (unsigned)(before > m_jobs.size() ? before - m_jobs.size() : 0));
+          return;
+        }
+
+        if (m_jobs.empty() || time < m_jobs.getDeparture(0))
+          return;
+
+        m_job_end = m_jobs.getStart(0) + m_jobs[0].duration;
+        m_job = m_jobs.take();
+        m_job_running = true;
+        m_job_seen = false;
+
+        IMC::PlanControl pc;
+        pc.type = IMC::PlanControl::PC_REQUEST;
+        pc.op = IMC::PlanControl::PC_START;
+        pc.plan_id = m_job.plan_id;
+        pc.flags = 0;
+        pc.setDestination(m_ctx.resolver.id());
+        sendRequest(pc);
+
+        inf("starting job %s, %u left", m_job.plan_id.c_str(), (unsigned)m_jobs.size());
+      }
+
+      //! Save the depth map.
+      void
+      saveDepthGrid(void)
+      {
+        if (m_depth.getTiles() == 0)
+          return;
+
+        try
+        {
+          m_depth.save(m_depth_path.str());
+        }
+        catch (std::exception& e)
+        {
+          err("depth map not saved: %s", e.what());
+        }
+      }
+
+      //! Report route changes caused by the depth map.
+      void
+      checkDepth(void)
+      {
+        unsigned shallow = m_planner->getShallow();
+        unsigned skipped = m_planner->getSkipped();
+        if (shallow + skipped == m_depth_reported)
+          return;
+
+        m_depth_reported = shallow + skipped;
+        inf("depth map: %u waypoints skipped over shallow water, %u mapped rows left out",
+            shallow, skipped);
+      }
+
+      //! Report loss and recovery of the formation leader.
+      void
+      checkFormation(void)
+      {
+        if (!m_formation || m_planner->isLeaderLost() == m_leader_lost)
+          return;
+
+        m_leader_lost = !m_leader_lost;
+        if (m_leader_lost)
+          war("formation leader lost, holding last reference");
+        else
+          inf("formation leader in sight");
+      }
+
+      //! Report hotspot cells added to the route.
+      void
+      checkHotspots(void)
+      {
+        unsigned refined = m_planner->getRefinements();
+        if (refined == m_refined_reported)
+          return;
+
+        m_refined_reported = refined;
+        inf("adaptive survey: %u hotspot cells refined", refined);
+      }
+
+      //! Dispatch the latest setpoint published by the planner, if any.
+      void
+      dispatchSetpoint(void)
+      {
+        Setpoint sp;
+        if (!m_planner->poll(m_setpoint_seq, sp))
+          return;
+
+        double time = now();
+
+        // Only touch the inline messages when their value changes,
+        // setting them allocates a new copy.
+        m_ref.lat = sp.lat;
+        m_ref.lon = sp.lon;
+        if (sp.speed != m_ref_speed)
+          setReferenceSpeed(sp.speed);
+        if (sp.z != m_ref_z)
+          setReferenceZ(sp.z);
+
+        send(m_ref);
+        m_ref_time = time;
+
+        if (isRecording())
+        {
+          TelemetryRecord rec = makeRecord(TelemetryRecord::REC_REFERENCE);
+          rec.lat = sp.lat;
+          rec.lon = sp.lon;
+          rec.z = sp.z;
+          rec.speed = sp.speed;
+          rec.index = sp.index;
+          rec.state = sp.complete;
+          record(rec);
+        }
+
+        if (sp.arrival >= 0.0)
+        {
+          double dead = time - sp.arrival;
+          m_dead_time += dead;
+          m_dead_time_max = std::max(m_dead_time_max, dead);
+          ++m_transitions;
+        }
+
+        if (sp.avoiding != m_avoiding)
+        {
+          m_avoiding = sp.avoiding;
+          if (m_avoiding)
+            war("steering clear of contact");
+          else
+            inf("clear of contacts, resuming route");
+        }
+
+        if (sp.avoiding)
+          return;
+
+        if (sp.returning && !m_returning)
+        {
+          war("predicted fuel margin below reserve, route cut to %u waypoints to return to base",
+              sp.count);
+          m_returning = true;
+        }
+
+        if (sp.complete)
+        {
+          inf("route complete, %u transitions, dead time mean %.3f s, max %.3f s",
+              m_transitions, m_transitions ? m_dead_time / m_transitions : 0.0,
+              m_dead_time_max);
+          inf("consume latency mean %.1f us, max %.1f us, %u events dropped",
+              m_consumed ? m_consume_time / m_consumed * 1e6 : 0.0,
+              m_consume_time_max * 1e6, m_planner->getDropped());
+          inf("navigation %lu reordered, %lu duplicate, %lu late, %lu held too long,"
+              " %lu rejected", m_nav.getReordered(), m_nav.getDuplicates(),
+              m_nav.getStale(), m_nav.getForced(), m_gate.getRejected());
+          return;
+        }
+
+        // Resuming after avoidance republishes the same waypoint.
+        if (m_route_started && sp.index == m_cursor)
+          return;
+
+        if (!m_route_started)
+        {
+          inf("starting route with %u waypoints", sp.count);
+          m_route_started = true;
+        }
+
+        m_cursor = sp.index;
+        debug("heading to waypoint %u", (unsigned)m_cursor);
+      }
+
+      void
+      consume(const IMC::PlanControl* msg)
+      {
+        if (!admit(msg))
+          return;
+
+        if (msg->type == IMC::PlanControl::PC_REQUEST)
+          return;
+
+        if (msg->getDestination() != getSystemId()
+            || msg->getDestinationEntity() != getEntityId())
+          return;
+
+        if (isRecording())
+        {
+          TelemetryRecord rec = makeRecord(TelemetryRecord::REC_PLAN_EVENT);
+          rec.index = msg->request_id;
+          rec.state = msg->type;
+          rec.proximity = msg->op;
+          record(rec);
+        }
+
+        IMC::PlanControl req;
+        switch (m_requests.onReply(*msg, now(), &req))
+        {
+          case PlanRequestTracker::OUTCOME_SUCCESS:
+            debug("request %u (%s) succeeded", req.request_id, req.plan_id.c_str());
+            break;
+          case PlanRequestTracker::OUTCOME_FAILURE:
+            err("request %u (%s) failed: %s", req.request_id, req.plan_id.c_str(),
+                msg->info.c_str());
+            break;
+          default:
+            break;
+        }
+      }
+
+      void
+      consume(const IMC::PlanControlState* msg)
+      {
+        if (!admit(msg))
+          return;
+
+        if (msg->getSource() != getSystemId())
+          return;
+
+        if (isRecording() && msg->state != m_plan_control_state.state)
+        {
+          TelemetryRecord rec = makeRecord(TelemetryRecord::REC_PLAN_STATE);
+          rec.state = msg->state;
+          rec.proximity = msg->last_outcome;
+          record(rec);
+        }
+
+        m_plan_control_state = *msg;
+
+        bool control = msg->plan_id == c_plan_id
+        && msg->state == IMC::PlanControlState::PCS_EXECUTING;
+
+        // Plan started again after a manual takeover or a stop.
+        if (control && !m_caravela_control && m_route_started)
+        {
+          PlannerEvent ev;
+          ev.type = PlannerEvent::EV_REJOIN;
+          ev.pose.time = now();
+          m_planner->post(ev);
+          inf("plan resumed, rejoining the route");
+        }
+
+        m_caravela_control = control;
+
+        m_requests.onState(*msg);
+      }
+
+      //! Send a PlanControl request through the request tracker.
+      //! @param[in] pc plan control request.
+      void
+      sendRequest(const IMC::PlanControl& pc)
+      {
+        IMC::PlanControl* msg = m_requests.submit(pc, now());
+        if (msg == NULL)
+        {
+          err("too many PlanControl requests in flight");
+          return;
+        }
+
+        send(*msg);
+      }
+
+      //! Retransmit overdue PlanControl requests.
+      void
+      checkRequests(void)
+      {
+        m_requests.poll(now(), m_resend, m_expired);
+
+        for (size_t i = 0; i < m_resend.size(); ++i)
+        {
+          war("no reply to request %u, retrying", m_resend[i].request_id);
+          send(m_resend[i]);
+        }
+
+        for (size_t i = 0; i < m_expired.size(); ++i)
+          err("request %u (%s) got no reply", m_expired[i].request_id, m_expired[i].plan_id.c_str());
+      }
+
+      void
+      abortMission(void)
+      {
+        if (m_requests.isPending(IMC::PlanControl::PC_STOP, c_plan_id))
+          return;
+
+        inf("Abort Task...");
+        sendRequest(m_pc_stop);
+      }
+
+      void
+      onDeactivation(void)
+      {
+        if (m_caravela_control && !isActive())
+        {
+          abortMission();
+        }
+      }
+
+      //! Work done after incoming messages are handled.
+      void
+      tick(void)
+      {
+        releaseNavigation();
+        dispatchSetpoint();
+        checkFence();
+        checkHotspots();
+        checkDepth();
+        checkFormation();
+        checkRequests();
+
+        if (m_scheduling)
+          checkSchedule();
+
+        // Activation is not part of the trace.
+        if (!m_replaying)
+          onDeactivation();
+
+        double time = now();
+        if (m_args.compressed && time - m_frame_time >= m_args.frame_period)
+          sendFrame();
+
+        if (m_args.kpi_period > 0.0 && time - m_stats_time >= m_args.kpi_period)
+          sendStatistics();
+
+        // Nothing to refresh until the planner produced a setpoint, and
+        // job plans drive the vehicle themselves.
+        if (!m_scheduling && m_setpoint_seq != 0 && time - m_ref_time >= m_args.refresh_period)
+        {
+          send(m_ref);
+          m_ref_time = time;
+        }
+      }
+
+      //! Task time, virtual while replaying a trace.
+      double
+      now(void) const
+      {
+        return m_replaying ? m_vtime : Clock::get();
+      }
+
+      //! Filter and trace an incoming message. Live messages are
+      //! ignored while replaying.
+      //! @param[in] msg message.
+      //! @return true if the message must be handled.
+      bool
+      admit(const IMC::Message* msg)
+      {
+        if (m_replaying)
+          return m_feeding;
+
+        if (m_trace.isOpen())
+          m_trace.write(now(), TraceRecord::TRACE_IN, msg);
+
+        return true;
+      }
+
+      //! Dispatch a message and trace it. While replaying the message
+      //! is compared with the recording instead.
+      //! @param[in] msg message.
+      void
+      send(IMC::Message& msg)
+      {
+        if (m_replaying)
+        {
+          m_diff.observe(msg, now());
+          return;
+        }
+
+        dispatch(msg);
+
+        if (m_trace.isOpen())
+          m_trace.write(now(), TraceRecord::TRACE_OUT, &msg);
+      }
+
+      //! Hand a recorded message to its consumer.
+      //! @param[in] msg message.
+      void
+      feed(const IMC::Message* msg)
+      {
+        m_feeding = true;
+
+        uint16_t id = msg->getId();
+
+        if (id == IMC::EstimatedState::getIdStatic())
+          consume(static_cast<const IMC::EstimatedState*>(msg));
+        else if (id == IMC::FollowRefState::getIdStatic())
+          consume(static_cast<const IMC::FollowRefState*>(msg));
+        else if (id == IMC::PlanControl::getIdStatic())
+          consume(static_cast<const IMC::PlanControl*>(msg));
+        else if (id == IMC::PlanControlState::getIdStatic())
+          consume(static_cast<const IMC::PlanControlState*>(msg));
+        else if (id == IMC::RemoteSensorInfo::getIdStatic())
+          consume(static_cast<const IMC::RemoteSensorInfo*>(msg));
+        else if (id == IMC::FuelLevel::getIdStatic())
+          consume(static_cast<const IMC::FuelLevel*>(msg));
+        else if (id == IMC::Target::getIdStatic())
+          consume(static_cast<const IMC::Target*>(msg));
+        else if (id == IMC::Chlorophyll::getIdStatic())
+          consume(static_cast<const IMC::Chlorophyll*>(msg));
+        else if (id == IMC::Abort::getIdStatic())
+          consume(static_cast<const IMC::Abort*>(msg));
+
+        m_feeding = false;
+      }
+
+      //! Drive the task from a recorded trace as fast as possible and
+      //! compare the references and plan requests it dispatches with
+      //! the recorded ones.
+      void
+      replay(void)
+      {
+        TraceReader rd;
+
+        try
+        {
+          rd.open(m_args.trace_replay);
+        }
+        catch (std::exception& e)
+        {
+          err("replay failed: %s", e.what());
+          return;
+        }
+
+        m_diff.watch(IMC::Reference::getIdStatic());
+        m_diff.watch(IMC::PlanControl::getIdStatic());
+
+        double begin = Clock::get();
+        double start = rd.header().start;
+        bool started = false;
+        unsigned long inputs = 0;
+        TraceRecord rec;
+        IMC::Message* msg;
+
+        m_vtime = start;
+        m_frame_time = start;
+        m_stats_time = start;
+
+        while (!stopping() && (msg = rd.next(rec)) != NULL)
+        {
+          m_vtime = rec.time;
+
+          if (!started && m_vtime - start >= m_args.waiting_time)
+          {
+            sendRequest(m_pc_start);
+            updateSpeed();
+            started = true;
+          }
+
+          if (rec.direction == TraceRecord::TRACE_OUT)
+          {
+            m_diff.expect(msg, rec.time);
+            continue;
+          }
+
+          feed(msg);
+          delete msg;
+          ++inputs;
+
+          m_planner->drain();
+          tick();
+        }
+
+        double elapsed = Clock::get() - begin;
+        inf("replayed %lu messages, %.1f s of trace in %.2f s",
+            inputs, m_vtime - start, elapsed);
+
+        if (m_diff.getMismatched() == 0 && m_diff.getMissing() == 0 && m_diff.getExtra() == 0)
+        {
+          inf("replay output matches the recording, %lu messages", m_diff.getMatched());
+          return;
+        }
+
+        war("replay output differs: %lu matched, %lu different, %lu missing, %lu extra",
+            m_diff.getMatched(), m_diff.getMismatched(),
+            (unsigned long)m_diff.getMissing(), (unsigned long)m_diff.getExtra());
+
+        if (m_diff.getMismatched() > 0)
+          war("first difference: %s at %.3f s",
+              m_diff.getFirstName().c_str(), m_diff.getFirstMismatch() - start);
+      }
+
+      //! Main loop.
+      void
+      onMain(void)
+      {
+        if (m_replaying)
+        {
+          replay();
+
+          while (!stopping())
+            waitForMessages(1.0);
+
+          return;
+        }
+
+        DUNE::Time::Delay::waitNsec(m_args.waiting_time * 1000000000.0);
+
+        // A day schedule is planned once the vehicle position is known.
+        if (!m_scheduling)
+        {
+          war("Starting followref");
+
+          sendRequest(m_pc_start);
+
+          DUNE::Time::Delay::waitNsec(1000000000.0);
+
+          updateSpeed();
+        }
+
+        while (!stopping())
+        {
+          waitForMessages(0.05);
+          tick();
+        }
       }
 
 
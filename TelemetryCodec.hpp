@@ -0,0 +1,532 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_TELEMETRY_CODEC_HPP_INCLUDED_
+#define MANEUVER_TEST_TELEMETRY_CODEC_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Local headers.
+#include "TelemetryLog.hpp"
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Earth radius used for the codec's local frame (m).
+    static const double c_codec_radius = 6378137.0;
+    //! Position and z resolution (m).
+    static const double c_codec_pos_res = 0.01;
+    //! Speed resolution (m/s).
+    static const double c_codec_speed_res = 0.01;
+    //! Heading steps per turn.
+    static const int c_codec_psi_steps = 4096;
+    //! Number of record types the codec keeps state for.
+    static const unsigned c_codec_streams = 8;
+
+    //! Compact wire format for telemetry records. Positions are
+    //! quantised in a local frame around a plan origin, and each
+    //! record is sent as the difference to the previous record of the
+    //! same type, as zigzag varints for the fields that changed.
+    //! Every few records per type a keyframe with absolute values
+    //! (and the origin) is sent so a decoder can join or resync.
+    //!
+    //! Each frame starts with a header byte and a frame number, so a
+    //! decoder notices lost frames and waits for the next keyframes
+    //! instead of applying deltas to stale values.
+    //!
+    //! Record layout: one byte with the record type, bit 7 set for
+    //! keyframes. Keyframes carry origin latitude and longitude
+    //! (1e-9 rad), absolute time (ms) and every field. Delta records
+    //! carry a byte with one bit per changed field, followed by those
+    //! fields' deltas.
+    class TelemetryCodec
+    {
+    protected:
+      //! Quantised record.
+      struct State
+      {
+        bool valid;
+        int64_t time;
+        int64_t x;
+        int64_t y;
+        int64_t z;
+        int64_t psi;
+        int64_t speed;
+        int64_t index;
+        uint8_t state;
+        uint8_t proximity;
+        unsigned since_key;
+      };
+
+      enum FieldMask
+      {
+        F_TIME = 0x01,
+        F_X = 0x02,
+        F_Y = 0x04,
+        F_Z = 0x08,
+        F_PSI = 0x10,
+        F_SPEED = 0x20,
+        F_INDEX = 0x40,
+        F_FLAGS = 0x80
+      };
+
+      //! Key bit in the type byte.
+      static const uint8_t c_key = 0x80;
+      //! Type byte of a frame header.
+      static const uint8_t c_frame = 0x7f;
+
+      //! Origin latitude (rad).
+      double m_lat0;
+      //! Origin longitude (rad).
+      double m_lon0;
+      //! Cosine of origin latitude.
+      double m_cos_lat0;
+      //! Last record per type.
+      State m_last[c_codec_streams];
+
+      TelemetryCodec(void)
+      {
+        setOrigin(0.0, 0.0);
+      }
+
+      void
+      setOrigin(double lat, double lon)
+      {
+        m_lat0 = lat;
+        m_lon0 = lon;
+        m_cos_lat0 = std::cos(lat);
+        reset();
+      }
+
+      void
+      reset(void)
+      {
+        std::memset(m_last, 0, sizeof(m_last));
+      }
+
+      static uint64_t
+      zigzag(int64_t v)
+      {
+        return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+      }
+
+      static int64_t
+      unzigzag(uint64_t v)
+      {
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+      }
+
+      static int64_t
+      wrapPsi(int64_t d)
+      {
+        return ((d + c_codec_psi_steps / 2) & (c_codec_psi_steps - 1)) - c_codec_psi_steps / 2;
+      }
+
+      static int64_t
+      quantise(double v, double res)
+      {
+        return (int64_t)std::floor(v / res + 0.5);
+      }
+
+      void
+      quantise(const TelemetryRecord& rec, State& s) const
+      {
+        s.time = quantise(rec.time, 0.001);
+        s.x = quantise((rec.lat - m_lat0) * c_codec_radius, c_codec_pos_res);
+        s.y = quantise((rec.lon - m_lon0) * c_codec_radius * m_cos_lat0, c_codec_pos_res);
+        s.z = quantise(rec.z, c_codec_pos_res);
+        s.psi = quantise(rec.psi / (2.0 * 3.14159265358979323846), 1.0 / c_codec_psi_steps)
+        & (c_codec_psi_steps - 1);
+        s.speed = quantise(rec.speed, c_codec_speed_res);
+        s.index = rec.index;
+        s.state = rec.state;
+        s.proximity = rec.proximity;
+      }
+
+      void
+      dequantise(const State& s, uint8_t type, TelemetryRecord& rec) const
+      {
+        std::memset(&rec, 0, sizeof(rec));
+        rec.type = type;
+        rec.time = s.time * 0.001;
+        rec.lat = m_lat0 + s.x * c_codec_pos_res / c_codec_radius;
+        rec.lon = m_lon0 + s.y * c_codec_pos_res / (c_codec_radius * m_cos_lat0);
+        rec.z = s.z * c_codec_pos_res;
+        double psi = s.psi * (2.0 * 3.14159265358979323846) / c_codec_psi_steps;
+        rec.psi = psi > 3.14159265358979323846 ? psi - 2.0 * 3.14159265358979323846 : psi;
+        rec.speed = s.speed * c_codec_speed_res;
+        rec.index = s.index;
+        rec.state = s.state;
+        rec.proximity = s.proximity;
+      }
+    };
+
+    //! Telemetry encoder.
+    class TelemetryEncoder: public TelemetryCodec
+    {
+    public:
+      //! Constructor.
+      //! @param[in] keyframe_interval records per type between keyframes.
+      TelemetryEncoder(unsigned keyframe_interval = 50):
+        m_interval(keyframe_interval),
+        m_frame_seq(0)
+      { }
+
+      //! Change the keyframe interval, applied from the next record.
+      //! @param[in] keyframe_interval records per type between keyframes.
+      void
+      setKeyframeInterval(unsigned keyframe_interval)
+      {
+        m_interval = keyframe_interval;
+      }
+
+      //! Set the plan origin, the next record of every type is a keyframe.
+      //! @param[in] lat origin latitude (rad).
+      //! @param[in] lon origin longitude (rad).
+      void
+      setOrigin(double lat, double lon)
+      {
+        TelemetryCodec::setOrigin(lat, lon);
+      }
+
+      //! Force a keyframe for every type, e.g. after link loss.
+      void
+      reset(void)
+      {
+        TelemetryCodec::reset();
+      }
+
+      //! Start a frame, before its first record.
+      //! @param[out] out output buffer.
+      void
+      beginFrame(std::vector<uint8_t>& out)
+      {
+        out.push_back((uint8_t)c_frame);
+        putVarint(out, m_frame_seq++);
+      }
+
+      //! Append an encoded record.
+      //! @param[in] rec record.
+      //! @param[out] out output buffer.
+      void
+      encode(const TelemetryRecord& rec, std::vector<uint8_t>& out)
+      {
+        uint8_t type = rec.type % c_codec_streams;
+        State& last = m_last[type];
+        State cur;
+        quantise(rec, cur);
+
+        if (!last.valid || last.since_key + 1 >= m_interval)
+        {
+          out.push_back(type | c_key);
+          putVarint(out, zigzag((int64_t)std::floor(m_lat0 * 1e9 + 0.5)));
+          putVarint(out, zigzag((int64_t)std::floor(m_lon0 * 1e9 + 0.5)));
+          putVarint(out, zigzag(cur.time));
+          putVarint(out, zigzag(cur.x));
+          putVarint(out, zigzag(cur.y));
+          putVarint(out, zigzag(cur.z));
+          putVarint(out, cur.psi);
+          putVarint(out, zigzag(cur.speed));
+          putVarint(out, cur.index);
+          out.push_back(cur.state);
+          out.push_back(cur.proximity);
+
+          cur.since_key = 0;
+        }
+        else
+        {
+          uint8_t mask = 0;
+          if (cur.time != last.time)
+            mask |= F_TIME;
+          if (cur.x != last.x)
+            mask |= F_X;
+          if (cur.y != last.y)
+            mask |= F_Y;
+          if (cur.z != last.z)
+            mask |= F_Z;
+          if (cur.psi != last.psi)
+            mask |= F_PSI;
+          if (cur.speed != last.speed)
+            mask |= F_SPEED;
+          if (cur.index != last.index)
+            mask |= F_INDEX;
+          if (cur.state != last.state || cur.proximity != last.proximity)
+            mask |= F_FLAGS;
+
+          out.push_back(type);
+          out.push_back(mask);
+          if (mask & F_TIME)
+            putVarint(out, zigzag(cur.time - last.time));
+          if (mask & F_X)
+            putVarint(out, zigzag(cur.x - last.x));
+          if (mask & F_Y)
+            putVarint(out, zigzag(cur.y - last.y));
+          if (mask & F_Z)
+            putVarint(out, zigzag(cur.z - last.z));
+          if (mask & F_PSI)
+            putVarint(out, zigzag(wrapPsi(cur.psi - last.psi)));
+          if (mask & F_SPEED)
+            putVarint(out, zigzag(cur.speed - last.speed));
+          if (mask & F_INDEX)
+            putVarint(out, zigzag(cur.index - last.index));
+          if (mask & F_FLAGS)
+          {
+            out.push_back(cur.state);
+            out.push_back(cur.proximity);
+          }
+
+          cur.since_key = last.since_key + 1;
+        }
+
+        cur.valid = true;
+        last = cur;
+      }
+
+    private:
+      //! Records per type between keyframes.
+      unsigned m_interval;
+      //! Number of the next frame.
+      uint32_t m_frame_seq;
+
+      static void
+      putVarint(std::vector<uint8_t>& out, uint64_t v)
+      {
+        while (v >= 0x80)
+        {
+          out.push_back((uint8_t)(v | 0x80));
+          v >>= 7;
+        }
+
+        out.push_back((uint8_t)v);
+      }
+    };
+
+    //! Telemetry decoder.
+    class TelemetryDecoder: public TelemetryCodec
+    {
+    public:
+      TelemetryDecoder(void):
+        m_has_frame(false),
+        m_next_frame(0),
+        m_lost(0)
+      { }
+
+      //! Result of decoding one record.
+      enum Result
+      {
+        //! A record was decoded.
+        DEC_RECORD,
+        //! A frame header was read.
+        DEC_FRAME,
+        //! A delta record arrived before its keyframe, or after a lost
+        //! frame, and was skipped.
+        DEC_SKIPPED,
+        //! Input ended in the middle of a record.
+        DEC_INCOMPLETE,
+        //! Input is malformed.
+        DEC_ERROR
+      };
+
+      //! Decode one record.
+      //! @param[in] data input.
+      //! @param[in] size input size.
+      //! @param[out] used number of bytes consumed.
+      //! @param[out] rec decoded record.
+      //! @return decoding result.
+      Result
+      decode(const uint8_t* data, size_t size, size_t& used, TelemetryRecord& rec)
+      {
+        const uint8_t* ptr = data;
+        const uint8_t* end = data + size;
+        used = 0;
+
+        if (ptr == end)
+          return DEC_INCOMPLETE;
+
+        uint8_t head = *ptr++;
+        uint64_t v;
+
+        if (head == c_frame)
+        {
+          if (!getVarint(ptr, end, v))
+            return DEC_INCOMPLETE;
+
+          // Deltas after a lost frame apply to values never seen.
+          uint32_t seq = (uint32_t)v;
+          if (m_has_frame && seq != m_next_frame)
+          {
+            m_lost += seq - m_next_frame;
+            for (unsigned i = 0; i < c_codec_streams; ++i)
+              m_last[i].valid = false;
+          }
+
+          m_has_frame = true;
+          m_next_frame = seq + 1;
+          used = ptr - data;
+          return DEC_FRAME;
+        }
+
+        uint8_t type = head & ~c_key;
+        if (type >= c_codec_streams)
+          return DEC_ERROR;
+
+        State& last = m_last[type];
+        State cur = last;
+
+        if (head & c_key)
+        {
+          int64_t lat, lon;
+          if (!getSigned(ptr, end, lat) || !getSigned(ptr, end, lon)
+              || !getSigned(ptr, end, cur.time) || !getSigned(ptr, end, cur.x)
+              || !getSigned(ptr, end, cur.y) || !getSigned(ptr, end, cur.z)
+              || !getVarint(ptr, end, v))
+            return DEC_INCOMPLETE;
+
+          cur.psi = v & (c_codec_psi_steps - 1);
+
+          if (!getSigned(ptr, end, cur.speed) || !getVarint(ptr, end, v) || end - ptr < 2)
+            return DEC_INCOMPLETE;
+
+          cur.index = v;
+          cur.state = *ptr++;
+          cur.proximity = *ptr++;
+
+          if (lat * 1e-9 != m_lat0 || lon * 1e-9 != m_lon0)
+          {
+            // New origin, deltas of other types are no longer valid.
+            TelemetryCodec::setOrigin(lat * 1e-9, lon * 1e-9);
+          }
+
+          cur.valid = true;
+        }
+        else
+        {
+          if (ptr == end)
+            return DEC_INCOMPLETE;
+
+          uint8_t mask = *ptr++;
+          int64_t d;
+
+          if ((mask & F_TIME) && !addSigned(ptr, end, cur.time))
+            return DEC_INCOMPLETE;
+          if ((mask & F_X) && !addSigned(ptr, end, cur.x))
+            return DEC_INCOMPLETE;
+          if ((mask & F_Y) && !addSigned(ptr, end, cur.y))
+            return DEC_INCOMPLETE;
+          if ((mask & F_Z) && !addSigned(ptr, end, cur.z))
+            return DEC_INCOMPLETE;
+          if (mask & F_PSI)
+          {
+            if (!getSigned(ptr, end, d))
+              return DEC_INCOMPLETE;
+            cur.psi = (cur.psi + d) & (c_codec_psi_steps - 1);
+          }
+          if ((mask & F_SPEED) && !addSigned(ptr, end, cur.speed))
+            return DEC_INCOMPLETE;
+          if ((mask & F_INDEX) && !addSigned(ptr, end, cur.index))
+            return DEC_INCOMPLETE;
+          if (mask & F_FLAGS)
+          {
+            if (end - ptr < 2)
+              return DEC_INCOMPLETE;
+            cur.state = *ptr++;
+            cur.proximity = *ptr++;
+          }
+        }
+
+        used = ptr - data;
+
+        if (!cur.valid)
+          return DEC_SKIPPED;
+
+        m_last[type] = cur;
+        dequantise(cur, type, rec);
+        return DEC_RECORD;
+      }
+
+      //! Number of frames found missing.
+      unsigned long
+      getLostFrames(void) const
+      {
+        return m_lost;
+      }
+
+    private:
+      //! True once a frame header was read.
+      bool m_has_frame;
+      //! Number of the frame expected next.
+      uint32_t m_next_frame;
+      //! Frames found missing.
+      unsigned long m_lost;
+
+      static bool
+      getVarint(const uint8_t*& ptr, const uint8_t* end, uint64_t& v)
+      {
+        v = 0;
+        for (unsigned shift = 0; ptr != end && shift < 64; shift += 7)
+        {
+          uint8_t b = *ptr++;
+          v |= (uint64_t)(b & 0x7f) << shift;
+          if (!(b & 0x80))
+            return true;
+        }
+
+        return false;
+      }
+
+      static bool
+      getSigned(const uint8_t*& ptr, const uint8_t* end, int64_t& v)
+      {
+        uint64_t u;
+        if (!getVarint(ptr, end, u))
+          return false;
+
+        v = unzigzag(u);
+        return true;
+      }
+
+      static bool
+      addSigned(const uint8_t*& ptr, const uint8_t* end, int64_t& v)
+      {
+        int64_t d;
+        if (!getSigned(ptr, end, d))
+          return false;
+
+        v += d;
+        return true;
+      }
+    };
+  }
+}
+
+#endif
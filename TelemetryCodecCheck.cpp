@@ -0,0 +1,270 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+// Round trip and throughput check of the compressed telemetry codec.
+//
+// Usage:
+//   TelemetryCodecCheck [records]
+//
+// A synthetic mission is encoded into frames and decoded back, once
+// with every frame and once with some frames dropped as on a lossy
+// link. The vehicle circles so heading wraps around. Every decoded
+// record must match the original within the codec resolution, and
+// after a lost frame deltas must be skipped until the next keyframe.
+// Exits with status 1 on any mismatch.
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// ISO C++ 11 headers.
+#include <chrono>
+
+// Local headers.
+#include "TelemetryCodec.hpp"
+
+using namespace Maneuver::Test;
+
+static const double c_pi = 3.14159265358979323846;
+//! Frame size used on the link (bytes).
+static const size_t c_frame_size = 200;
+//! One frame in this many is dropped by the lossy run.
+static const size_t c_drop_every = 7;
+
+//! Encoded frame.
+struct Frame
+{
+  std::vector<uint8_t> data;
+  //! Index of the first record in the frame.
+  size_t first;
+};
+
+//! Decoding outcome.
+struct Outcome
+{
+  unsigned long decoded;
+  unsigned long skipped;
+  unsigned long keyframes;
+  unsigned long mismatches;
+  unsigned long lost;
+};
+
+static double
+seconds(void)
+{
+  using namespace std::chrono;
+  return duration_cast<duration<double> >(steady_clock::now().time_since_epoch()).count();
+}
+
+//! Vehicle circling at 1.5 m/s with references and FollowRefState
+//! reports interleaved.
+static void
+generate(size_t count, std::vector<TelemetryRecord>& recs)
+{
+  double lat0 = 0.7188;
+  double lon0 = -0.1523;
+  double radius = 40.0;
+
+  recs.resize(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    TelemetryRecord& r = recs[i];
+    std::memset(&r, 0, sizeof(r));
+
+    double t = i * 0.1;
+    double a = 1.5 * t / radius;
+    double n = radius * std::sin(a) + 0.02 * t;
+    double e = radius * (1.0 - std::cos(a));
+
+    r.time = 1.6e9 + t;
+    r.lat = lat0 + n / c_codec_radius;
+    r.lon = lon0 + e / (c_codec_radius * std::cos(lat0));
+    r.z = 2.0 + 0.5 * std::sin(0.01 * t);
+    r.psi = std::atan2(std::sin(a + c_pi / 2.0), std::cos(a + c_pi / 2.0));
+    r.speed = 1.5;
+    r.index = i / 300;
+
+    if (i % 50 == 0)
+      r.type = TelemetryRecord::REC_REFERENCE;
+    else if (i % 10 == 0)
+      r.type = TelemetryRecord::REC_FOLLOW_REF;
+    else
+      r.type = TelemetryRecord::REC_POSE;
+
+    r.state = r.type == TelemetryRecord::REC_FOLLOW_REF ? (i / 1000) % 4 : 0;
+    r.proximity = r.type == TelemetryRecord::REC_FOLLOW_REF ? (i / 70) % 8 : 0;
+  }
+}
+
+static void
+encode(const std::vector<TelemetryRecord>& recs, std::vector<Frame>& frames)
+{
+  TelemetryEncoder enc;
+  enc.setOrigin(recs[0].lat, recs[0].lon);
+
+  frames.clear();
+  for (size_t i = 0; i < recs.size(); ++i)
+  {
+    if (frames.empty() || frames.back().data.size() >= c_frame_size)
+    {
+      frames.push_back(Frame());
+      frames.back().first = i;
+      enc.beginFrame(frames.back().data);
+    }
+
+    enc.encode(recs[i], frames.back().data);
+  }
+}
+
+static bool
+matches(const TelemetryRecord& a, const TelemetryRecord& b)
+{
+  double dn = (a.lat - b.lat) * c_codec_radius;
+  double de = (a.lon - b.lon) * c_codec_radius * std::cos(a.lat);
+  double dpsi = std::fabs(std::remainder((double)a.psi - b.psi, 2.0 * c_pi));
+
+  return a.type == b.type
+  && std::fabs(a.time - b.time) <= 0.0005 + 1e-6
+  && std::sqrt(dn * dn + de * de) <= c_codec_pos_res
+  && std::fabs(a.z - b.z) <= c_codec_pos_res
+  && dpsi <= 2.0 * c_pi / c_codec_psi_steps
+  && std::fabs(a.speed - b.speed) <= c_codec_speed_res
+  && a.index == b.index && a.state == b.state && a.proximity == b.proximity;
+}
+
+//! Decode frames, skipping every drop-th one when drop is not zero.
+static Outcome
+decode(const std::vector<TelemetryRecord>& recs, const std::vector<Frame>& frames,
+       size_t drop)
+{
+  Outcome o = {0, 0, 0, 0, 0};
+  TelemetryDecoder dec;
+  TelemetryRecord rec;
+
+  for (size_t f = 0; f < frames.size(); ++f)
+  {
+    if (drop != 0 && f % drop == drop - 1)
+      continue;
+
+    const std::vector<uint8_t>& data = frames[f].data;
+    size_t next = frames[f].first;
+    size_t off = 0;
+
+    while (off < data.size())
+    {
+      size_t used;
+      bool key = (data[off] & 0x80) != 0;
+      TelemetryDecoder::Result res = dec.decode(&data[off], data.size() - off, used, rec);
+
+      if (res == TelemetryDecoder::DEC_INCOMPLETE || res == TelemetryDecoder::DEC_ERROR)
+      {
+        std::fprintf(stderr, "frame %lu: malformed at byte %lu\n",
+                     (unsigned long)f, (unsigned long)off);
+        ++o.mismatches;
+        break;
+      }
+
+      off += used;
+      if (res == TelemetryDecoder::DEC_FRAME)
+        continue;
+
+      if (res == TelemetryDecoder::DEC_SKIPPED)
+      {
+        ++o.skipped;
+      }
+      else
+      {
+        ++o.decoded;
+        if (key)
+          ++o.keyframes;
+
+        if (!matches(recs[next], rec))
+        {
+          if (o.mismatches == 0)
+            std::fprintf(stderr, "record %lu decoded wrong\n", (unsigned long)next);
+          ++o.mismatches;
+        }
+      }
+
+      ++next;
+    }
+  }
+
+  o.lost = dec.getLostFrames();
+  return o;
+}
+
+int
+main(int argc, char** argv)
+{
+  size_t count = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 100000;
+  if (count == 0)
+  {
+    std::fprintf(stderr, "usage: %s [records]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<TelemetryRecord> recs;
+  generate(count, recs);
+
+  std::vector<Frame> frames;
+  double t0 = seconds();
+  encode(recs, frames);
+  double t1 = seconds();
+  Outcome all = decode(recs, frames, 0);
+  double t2 = seconds();
+  Outcome lossy = decode(recs, frames, c_drop_every);
+
+  size_t bytes = 0;
+  for (size_t f = 0; f < frames.size(); ++f)
+    bytes += frames[f].data.size();
+
+  size_t dropped = frames.size() / c_drop_every;
+
+  std::printf("%lu records in %lu frames, %.2f bytes per record, %.1fx smaller than raw\n",
+              (unsigned long)count, (unsigned long)frames.size(), (double)bytes / count,
+              (double)count * sizeof(TelemetryRecord) / bytes);
+  std::printf("encode %.1f ns per record, decode %.1f ns per record\n",
+              (t1 - t0) / count * 1e9, (t2 - t1) / count * 1e9);
+  std::printf("all frames: %lu decoded, %lu keyframes, %lu mismatches\n",
+              all.decoded, all.keyframes, all.mismatches);
+  std::printf("%lu frames dropped: %lu decoded, %lu skipped, %lu lost, %lu mismatches\n",
+              (unsigned long)dropped, lossy.decoded, lossy.skipped, lossy.lost,
+              lossy.mismatches);
+
+  bool ok = all.decoded == count && all.skipped == 0 && all.mismatches == 0
+  && lossy.mismatches == 0 && lossy.lost == dropped && lossy.skipped > 0;
+
+  if (!ok)
+    std::fprintf(stderr, "codec check failed\n");
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+// Offline export of telemetry segments written by the task.
+//
+// Usage:
+//   TelemetryExport csv <output.csv> <segment.tlog>...
+//   TelemetryExport columns <output-dir> <segment.tlog>...
+//
+// The columnar format writes one little endian binary file per field
+// plus a schema.txt describing name, type and number of values.
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+
+// Local headers.
+#include "TelemetryLog.hpp"
+
+using namespace Maneuver::Test;
+
+static const double c_degrees = 180.0 / 3.14159265358979323846;
+
+//! Output column.
+struct Column
+{
+  const char* name;
+  const char* type;
+  std::FILE* file;
+};
+
+static void
+writeCsv(std::FILE* out, const TelemetryReader& rd)
+{
+  for (const TelemetryRecord* r = rd.begin(); r != rd.end(); ++r)
+  {
+    std::fprintf(out, "%.6f,%u,%.8f,%.8f,%.3f,%.4f,%.3f,%u,%u,%u\n",
+                 r->time, r->type, r->lat * c_degrees, r->lon * c_degrees,
+                 r->z, r->psi, r->speed, r->index, r->state, r->proximity);
+  }
+}
+
+static void
+writeColumns(Column* cols, const TelemetryReader& rd)
+{
+  for (const TelemetryRecord* r = rd.begin(); r != rd.end(); ++r)
+  {
+    std::fwrite(&r->time, sizeof(r->time), 1, cols[0].file);
+    std::fwrite(&r->type, sizeof(r->type), 1, cols[1].file);
+    std::fwrite(&r->lat, sizeof(r->lat), 1, cols[2].file);
+    std::fwrite(&r->lon, sizeof(r->lon), 1, cols[3].file);
+    std::fwrite(&r->z, sizeof(r->z), 1, cols[4].file);
+    std::fwrite(&r->psi, sizeof(r->psi), 1, cols[5].file);
+    std::fwrite(&r->speed, sizeof(r->speed), 1, cols[6].file);
+    std::fwrite(&r->index, sizeof(r->index), 1, cols[7].file);
+    std::fwrite(&r->state, sizeof(r->state), 1, cols[8].file);
+    std::fwrite(&r->proximity, sizeof(r->proximity), 1, cols[9].file);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc < 4)
+  {
+    std::fprintf(stderr, "Usage: %s csv|columns <output> <segment.tlog>...\n", argv[0]);
+    return 1;
+  }
+
+  std::string mode = argv[1];
+  std::string output = argv[2];
+  bool csv = mode == "csv";
+
+  if (!csv && mode != "columns")
+  {
+    std::fprintf(stderr, "unknown mode '%s'\n", mode.c_str());
+    return 1;
+  }
+
+  Column cols[] =
+  {
+    {"time", "f64", NULL},
+    {"type", "u8", NULL},
+    {"lat", "f64", NULL},
+    {"lon", "f64", NULL},
+    {"z", "f32", NULL},
+    {"psi", "f32", NULL},
+    {"speed", "f32", NULL},
+    {"index", "u32", NULL},
+    {"state", "u8", NULL},
+    {"proximity", "u8", NULL}
+  };
+  const unsigned ncols = sizeof(cols) / sizeof(cols[0]);
+
+  std::FILE* out = NULL;
+  if (csv)
+  {
+    out = std::fopen(output.c_str(), "w");
+    if (out == NULL)
+    {
+      std::perror(output.c_str());
+      return 1;
+    }
+
+    std::fprintf(out, "time,type,lat,lon,z,psi,speed,index,state,proximity\n");
+  }
+  else
+  {
+    for (unsigned i = 0; i < ncols; ++i)
+    {
+      std::string path = output + "/" + cols[i].name + "." + cols[i].type;
+      cols[i].file = std::fopen(path.c_str(), "wb");
+      if (cols[i].file == NULL)
+      {
+        std::perror(path.c_str());
+        return 1;
+      }
+    }
+  }
+
+  unsigned long total = 0;
+  int rv = 0;
+
+  for (int i = 3; i < argc; ++i)
+  {
+    TelemetryReader rd;
+
+    try
+    {
+      rd.open(argv[i]);
+    }
+    catch (std::exception& e)
+    {
+      std::fprintf(stderr, "%s\n", e.what());
+      rv = 1;
+      continue;
+    }
+
+    if (csv)
+      writeCsv(out, rd);
+    else
+      writeColumns(cols, rd);
+
+    total += rd.size();
+  }
+
+  if (csv)
+  {
+    std::fclose(out);
+  }
+  else
+  {
+    for (unsigned i = 0; i < ncols; ++i)
+      std::fclose(cols[i].file);
+
+    std::string path = output + "/schema.txt";
+    std::FILE* schema = std::fopen(path.c_str(), "w");
+    if (schema != NULL)
+    {
+      for (unsigned i = 0; i < ncols; ++i)
+        std::fprintf(schema, "%s %s %lu\n", cols[i].name, cols[i].type, total);
+      std::fclose(schema);
+    }
+  }
+
+  std::fprintf(stderr, "exported %lu records\n", total);
+  return rv;
+}
@@ -0,0 +1,407 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_TELEMETRY_LOG_HPP_INCLUDED_
+#define MANEUVER_TEST_TELEMETRY_LOG_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Telemetry segment magic number ("TLOG").
+    static const uint32_t c_tlog_magic = 0x474f4c54;
+    //! Telemetry segment format version.
+    static const uint16_t c_tlog_version = 1;
+
+    //! Fixed size telemetry record.
+    struct TelemetryRecord
+    {
+      enum Type
+      {
+        //! Vehicle pose from EstimatedState.
+        REC_POSE = 1,
+        //! Reference dispatched to the vehicle.
+        REC_REFERENCE = 2,
+        //! FollowRefState report.
+        REC_FOLLOW_REF = 3,
+        //! PlanControl reply.
+        REC_PLAN_EVENT = 4,
+        //! PlanControlState change.
+        REC_PLAN_STATE = 5
+      };
+
+      //! Time (s since epoch).
+      double time;
+      //! Latitude (rad).
+      double lat;
+      //! Longitude (rad).
+      double lon;
+      //! Depth or z reference (m).
+      float z;
+      //! Heading (rad).
+      float psi;
+      //! Speed (m/s).
+      float speed;
+      //! Waypoint index or request id.
+      uint32_t index;
+      //! Record type.
+      uint8_t type;
+      //! FollowRefState state, PlanControl type, PlanControlState
+      //! state, or non-zero on the last reference of the route.
+      uint8_t state;
+      //! FollowRefState proximity, PlanControl operation or
+      //! PlanControlState last outcome.
+      uint8_t proximity;
+      //! Reserved, zero.
+      uint8_t reserved[5];
+    };
+
+    //! Segment file header, followed by the records.
+    struct TelemetryHeader
+    {
+      //! Magic number.
+      uint32_t magic;
+      //! Format version.
+      uint16_t version;
+      //! Size of one record.
+      uint16_t record_size;
+      //! Segment sequence number.
+      uint32_t segment;
+      //! Maximum number of records in the segment.
+      uint32_t capacity;
+      //! Number of valid records.
+      uint64_t count;
+      //! Time of the first record (s since epoch).
+      double start_time;
+      //! Reserved, zero.
+      uint8_t reserved[32];
+    };
+
+    //! Appends telemetry records to memory-mapped segment files.
+    //! Appending is a copy into the mapping, system calls only happen
+    //! when a segment fills up and the next one is created.
+    class TelemetryWriter
+    {
+    public:
+      TelemetryWriter(void):
+        m_fd(-1),
+        m_header(NULL),
+        m_records(NULL),
+        m_segment(0),
+        m_capacity(0),
+        m_total(0),
+        m_untrimmed(0)
+      { }
+
+      ~TelemetryWriter(void)
+      {
+        close();
+      }
+
+      //! Start a new log.
+      //! @param[in] dir output directory.
+      //! @param[in] prefix segment file name prefix.
+      //! @param[in] segment_size size of each segment file (bytes).
+      void
+      open(const std::string& dir, const std::string& prefix, size_t segment_size)
+      {
+        close();
+
+        m_dir = dir;
+        m_prefix = prefix;
+        m_segment = 0;
+        m_total = 0;
+        m_untrimmed = 0;
+
+        size_t records = (segment_size - sizeof(TelemetryHeader)) / sizeof(TelemetryRecord);
+        m_capacity = records < 1 ? 1 : records;
+
+        openSegment();
+      }
+
+      //! Append a record.
+      //! @param[in] rec record.
+      //! @return false if the log is closed or the next segment
+      //! could not be created.
+      bool
+      append(const TelemetryRecord& rec)
+      {
+        if (m_header == NULL)
+          return false;
+
+        if (m_header->count == m_capacity)
+        {
+          try
+          {
+            ++m_segment;
+            openSegment();
+          }
+          catch (std::exception&)
+          {
+            closeSegment();
+            return false;
+          }
+        }
+
+        if (m_header->count == 0)
+          m_header->start_time = rec.time;
+
+        std::memcpy(m_records + m_header->count, &rec, sizeof(rec));
+        ++m_header->count;
+        ++m_total;
+        return true;
+      }
+
+      //! Close the current segment.
+      //! @return false if a segment of this log could not be trimmed
+      //! to the records it holds.
+      bool
+      close(void)
+      {
+        closeSegment();
+        return m_untrimmed == 0;
+      }
+
+      //! Check if the log accepts records.
+      bool
+      isOpen(void) const
+      {
+        return m_header != NULL;
+      }
+
+      //! Total number of records written.
+      uint64_t
+      getCount(void) const
+      {
+        return m_total;
+      }
+
+    private:
+      //! Segment file descriptor.
+      int m_fd;
+      //! Mapped segment header.
+      TelemetryHeader* m_header;
+      //! Mapped segment records.
+      TelemetryRecord* m_records;
+      //! Output directory.
+      std::string m_dir;
+      //! File name prefix.
+      std::string m_prefix;
+      //! Current segment number.
+      uint32_t m_segment;
+      //! Records per segment.
+      size_t m_capacity;
+      //! Records written to all segments.
+      uint64_t m_total;
+      //! Segments left at full size because trimming failed.
+      unsigned m_untrimmed;
+
+      //! Create and map the current segment file.
+      void
+      openSegment(void)
+      {
+        closeSegment();
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "_%06u.tlog", m_segment);
+        std::string path = m_dir + "/" + m_prefix + name;
+
+        size_t bytes = sizeof(TelemetryHeader) + m_capacity * sizeof(TelemetryRecord);
+
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+          throw std::runtime_error(path + ": " + std::strerror(errno));
+
+        if (::ftruncate(m_fd, bytes) != 0)
+        {
+          int error = errno;
+          ::close(m_fd);
+          m_fd = -1;
+          throw std::runtime_error(path + ": " + std::strerror(error));
+        }
+
+        void* map = ::mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (map == MAP_FAILED)
+        {
+          int error = errno;
+          ::close(m_fd);
+          m_fd = -1;
+          throw std::runtime_error(path + ": " + std::strerror(error));
+        }
+
+        m_header = static_cast<TelemetryHeader*>(map);
+        std::memset(m_header, 0, sizeof(TelemetryHeader));
+        m_header->magic = c_tlog_magic;
+        m_header->version = c_tlog_version;
+        m_header->record_size = sizeof(TelemetryRecord);
+        m_header->segment = m_segment;
+        m_header->capacity = m_capacity;
+        m_records = reinterpret_cast<TelemetryRecord*>(m_header + 1);
+      }
+
+      //! Unmap the current segment and trim unused space. A segment
+      //! that cannot be trimmed is still valid, only larger.
+      void
+      closeSegment(void)
+      {
+        if (m_header != NULL)
+        {
+          size_t bytes = sizeof(TelemetryHeader) + m_capacity * sizeof(TelemetryRecord);
+          size_t used = sizeof(TelemetryHeader) + m_header->count * sizeof(TelemetryRecord);
+          ::munmap(m_header, bytes);
+          if (::ftruncate(m_fd, used) != 0)
+            ++m_untrimmed;
+          m_header = NULL;
+          m_records = NULL;
+        }
+
+        if (m_fd >= 0)
+        {
+          ::close(m_fd);
+          m_fd = -1;
+        }
+      }
+    };
+
+    //! Read-only view of one telemetry segment file.
+    class TelemetryReader
+    {
+    public:
+      TelemetryReader(void):
+        m_map(NULL),
+        m_size(0),
+        m_count(0)
+      { }
+
+      ~TelemetryReader(void)
+      {
+        close();
+      }
+
+      //! Map a segment file.
+      //! @param[in] path segment file.
+      void
+      open(const std::string& path)
+      {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+          throw std::runtime_error(path + ": " + std::strerror(errno));
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TelemetryHeader))
+        {
+          ::close(fd);
+          throw std::runtime_error(path + ": truncated segment");
+        }
+
+        void* map = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+          throw std::runtime_error(path + ": " + std::strerror(errno));
+
+        m_map = map;
+        m_size = st.st_size;
+
+        const TelemetryHeader* hdr = header();
+        if (hdr->magic != c_tlog_magic || hdr->record_size != sizeof(TelemetryRecord))
+        {
+          close();
+          throw std::runtime_error(path + ": not a telemetry segment");
+        }
+
+        // A segment that was not closed cleanly may claim more
+        // records than the file holds.
+        size_t available = (m_size - sizeof(TelemetryHeader)) / sizeof(TelemetryRecord);
+        m_count = hdr->count < available ? hdr->count : available;
+      }
+
+      //! Unmap the segment.
+      void
+      close(void)
+      {
+        if (m_map != NULL)
+          ::munmap(m_map, m_size);
+
+        m_map = NULL;
+        m_size = 0;
+        m_count = 0;
+      }
+
+      const TelemetryHeader*
+      header(void) const
+      {
+        return static_cast<const TelemetryHeader*>(m_map);
+      }
+
+      const TelemetryRecord*
+      begin(void) const
+      {
+        return reinterpret_cast<const TelemetryRecord*>(header() + 1);
+      }
+
+      const TelemetryRecord*
+      end(void) const
+      {
+        return begin() + m_count;
+      }
+
+      size_t
+      size(void) const
+      {
+        return m_count;
+      }
+
+    private:
+      //! Mapped file.
+      void* m_map;
+      //! Mapped size.
+      size_t m_size;
+      //! Number of valid records.
+      size_t m_count;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,168 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Tore Mo                                                          *
+//***************************************************************************
+
+#ifndef MANEUVER_TEST_YOYO_PROFILE_HPP_INCLUDED_
+#define MANEUVER_TEST_YOYO_PROFILE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "Route.hpp"
+
+namespace Maneuver
+{
+  namespace Test
+  {
+    //! Vertical sawtooth between two z limits laid over horizontal
+    //! legs. Each leg is sampled into 3D waypoints, one every fixed z
+    //! step plus the turning points, and the profile carries on from
+    //! one leg to the next so the sawtooth is continuous along the
+    //! route.
+    class YoyoProfile
+    {
+    public:
+      YoyoProfile(void):
+        m_z_min(0.0),
+        m_z_max(0.0),
+        m_slope(0.0),
+        m_step(1.0),
+        m_z(0.0),
+        m_dir(1)
+      { }
+
+      //! Set profile limits.
+      //! @param[in] z_min shallowest z (m).
+      //! @param[in] z_max deepest z (m).
+      //! @param[in] pitch flight path angle (rad).
+      //! @param[in] step z change between waypoints (m).
+      void
+      setup(double z_min, double z_max, double pitch, double step)
+      {
+        m_z_min = std::min(z_min, z_max);
+        m_z_max = std::max(z_min, z_max);
+        m_slope = std::tan(pitch);
+        m_step = step;
+        m_z = m_z_min;
+        m_dir = 1;
+      }
+
+      //! Continue the profile from a given z, keeping the current
+      //! direction unless the z is at a limit.
+      //! @param[in] z vertical reference (m).
+      void
+      resume(double z)
+      {
+        m_z = std::max(m_z_min, std::min(z, m_z_max));
+        if (m_z >= m_z_max)
+          m_dir = -1;
+        else if (m_z <= m_z_min)
+          m_dir = 1;
+      }
+
+      //! Sample a leg. The start point is not included, the end point
+      //! always is.
+      //! @param[in] x0 start northing (m).
+      //! @param[in] y0 start easting (m).
+      //! @param[in] to end waypoint, its z is replaced.
+      //! @param[out] wps leg waypoints.
+      void
+      leg(double x0, double y0, const Waypoint& to, std::vector<Waypoint>& wps)
+      {
+        wps.clear();
+
+        double dx = to.x - x0;
+        double dy = to.y - y0;
+        double len = std::sqrt(dx * dx + dy * dy);
+
+        // Flat range or degenerate leg, nothing to climb.
+        if (m_slope <= 0.0 || m_z_max <= m_z_min)
+        {
+          wps.push_back(to);
+          wps.back().z = m_z;
+          return;
+        }
+
+        double run = m_step / m_slope;
+        double pos = 0.0;
+
+        // Stop short of sub-millimetre steps left by rounding.
+        while (pos < len - 1e-3)
+        {
+          double turn = (m_dir > 0 ? m_z_max - m_z : m_z - m_z_min) / m_slope;
+          double ds = std::min(std::min(run, turn), len - pos);
+
+          pos += ds;
+          m_z += m_dir * ds * m_slope;
+
+          // Snap turning points so rounding never overshoots a limit.
+          if (ds >= turn)
+          {
+            m_z = m_dir > 0 ? m_z_max : m_z_min;
+            m_dir = -m_dir;
+          }
+
+          double f = pos / len;
+          wps.push_back(Waypoint(x0 + f * dx, y0 + f * dy, m_z, to.survey, to.row));
+        }
+
+        if (wps.empty())
+        {
+          wps.push_back(to);
+          wps.back().z = m_z;
+          return;
+        }
+
+        wps.back().x = to.x;
+        wps.back().y = to.y;
+      }
+
+    private:
+      //! Shallowest z (m).
+      double m_z_min;
+      //! Deepest z (m).
+      double m_z_max;
+      //! Z change per horizontal metre.
+      double m_slope;
+      //! Z change between waypoints (m).
+      double m_step;
+      //! Z at the end of the last sampled leg (m).
+      double m_z;
+      //! Direction of z change, 1 going deeper, -1 going shallower.
+      int m_dir;
+    };
+  }
+}
+
+#endif